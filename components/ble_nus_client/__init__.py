@@ -13,22 +13,97 @@ CONF_ON_CONNECTED = "on_connected"
 CONF_ON_DISCONNECTED = "on_disconnected"
 CONF_ON_SENT = "on_sent"
 CONF_ON_DATA = "on_data"
+CONF_ON_FLUSH_COMPLETE = "on_flush_complete"
+CONF_FLUSH_TIMEOUT = "flush_timeout"
+CONF_RX_BUFFER_SIZE = "rx_buffer_size"
+CONF_TX_BUFFER_SIZE = "tx_buffer_size"
+CONF_BUFFERS_IN_PSRAM = "buffers_in_psram"
+CONF_HIGH_WATERMARK = "high_watermark"
+CONF_LOW_WATERMARK = "low_watermark"
+CONF_RX_OVERFLOW_POLICY = "rx_overflow_policy"
+CONF_ON_RX_HIGH_WATERMARK = "on_rx_high_watermark"
+CONF_ON_FRAME = "on_frame"
+CONF_ON_MESSAGE = "on_message"
+CONF_MESSAGE = "message"
+CONF_IDLE_GAP = "idle_gap"
+CONF_MAX_SIZE = "max_size"
+CONF_MAX_LATENCY = "max_latency"
+CONF_DELIMITER = "delimiter"
+CONF_FRAMING = "framing"
+CONF_COMPRESSION = "compression"
+CONF_MAX_FRAME_SIZE = "max_frame_size"
+CONF_SCHEDULER_ID = "scheduler_id"
+CONF_SESSION_TIMEOUT = "session_timeout"
 CONNECT_ACTION = "ble_nus_client.connect"
 DISCONNECT_ACTION = "ble_nus_client.disconnect"
 SEND_ACTION = "ble_nus_client.send"
 CONF_IDLE_TIMEOUT = "idle_timeout"
 CONF_CONNECT_ON_DEMAND = "connect_on_demand"
+CONF_WRITE_MODE = "write_mode"
+CONF_RX_MODE = "rx_mode"
+CONF_TX_CREDITS = "tx_credits"
+CONF_MAX_OUTSTANDING_REQUESTS = "max_outstanding_requests"
+CONF_CONNECTION_PROFILES = "connection_profiles"
+CONF_PHY = "phy"
+CONF_CACHE_HANDLES = "cache_handles"
+CONF_SECURITY = "security"
+CONF_KEEP_WARM = "keep_warm"
+CONF_POLL_INTERVAL = "poll_interval"
+CONF_LEAD_TIME = "lead_time"
+CONF_DATA_LENGTH = "data_length"
+CONF_BULK = "bulk"
+CONF_IDLE = "idle"
+CONF_IDLE_DELAY = "idle_delay"
+CONF_MIN_INTERVAL = "min_interval"
+CONF_MAX_INTERVAL = "max_interval"
+CONF_LATENCY = "latency"
+CONF_TIMEOUT = "timeout"
 
 DEPENDENCIES = ["uart", "ble_client"]
-AUTO_LOAD = ["uart", "ble_client", "ring_buffer"]
+AUTO_LOAD = ["uart", "ble_client", "ble_nus_common"]
 
 CONF_TX_UUID = "tx_uuid"
 CONF_RX_UUID = "rx_uuid"
 
+# ble_nus_common::LZ_MAX_CHUNK_INPUT
+LZ_MAX_CHUNK_INPUT = 1024
+
 ble_nus_client_ns = cg.esphome_ns.namespace("ble_nus_client")
 BLENUSClientComponent = ble_nus_client_ns.class_(
     "BLENUSClientComponent", uart.UARTComponent, cg.Component
 )
+WriteMode = BLENUSClientComponent.enum("WriteMode", True)
+SecurityMode = BLENUSClientComponent.enum("SecurityMode", True)
+RxMode = BLENUSClientComponent.enum("RxMode", True)
+SECURITY_MODES = {
+    "none": SecurityMode.NONE,
+    "just_works": SecurityMode.JUST_WORKS,
+    "passkey": SecurityMode.PASSKEY,
+    "passkey_bond": SecurityMode.PASSKEY_BOND,
+}
+
+ble_nus_common_ns = cg.esphome_ns.namespace("ble_nus_common")
+RxOverflowPolicy = ble_nus_common_ns.enum("RxOverflowPolicy", True)
+# declared here rather than imported so ble_nus_scheduler stays optional
+BLENUSScheduler = cg.esphome_ns.namespace("ble_nus_scheduler").class_("BLENUSScheduler", cg.Component)
+
+RX_OVERFLOW_POLICIES = {
+    "drop_newest": RxOverflowPolicy.DROP_NEWEST,
+    "drop_oldest": RxOverflowPolicy.DROP_OLDEST,
+    "pause": RxOverflowPolicy.PAUSE,
+}
+
+RX_MODES = {
+    "notify": RxMode.NOTIFY,
+    "indicate": RxMode.INDICATE,
+    "auto": RxMode.AUTO,
+}
+
+WRITE_MODES = {
+    "response": WriteMode.WITH_RESPONSE,
+    "no_response": WriteMode.WITHOUT_RESPONSE,
+}
+
 BLENUSClientConnectAction = ble_nus_client_ns.class_("BLENUSClientConnectAction", automation.Action)
 BLENUSClientDisconnectAction = ble_nus_client_ns.class_("BLENUSClientDisconnectAction", automation.Action)
 BLENUSClientSendAction = ble_nus_client_ns.class_("BLENUSClientSendAction", automation.Action)
@@ -47,22 +122,196 @@ def _uuid_128(value):
     raise cv.Invalid(f"Bluetooth UUID must be in 128-bit '{_UUID128_FORMAT}' format")
 
 
-CONFIG_SCHEMA = cv.Schema(
+def _data_length(value):
+    if isinstance(value, str) and value.lower() == "auto":
+        return 251
+    return cv.int_range(min=27, max=251)(value)
+
+
+def _validate_security(config):
+    if config[CONF_SECURITY] in ("passkey", "passkey_bond") and CONF_PIN not in config:
+        raise cv.Invalid(f"'{CONF_PIN}' is required with security '{config[CONF_SECURITY]}'")
+    return config
+
+
+def _validate_conn_params(config):
+    if config[CONF_MIN_INTERVAL] > config[CONF_MAX_INTERVAL]:
+        raise cv.Invalid(f"{CONF_MIN_INTERVAL} must not be greater than {CONF_MAX_INTERVAL}")
+    return config
+
+
+def _conn_params_schema(min_interval, max_interval, latency, timeout):
+    interval = cv.All(
+        cv.positive_time_period_microseconds,
+        cv.Range(min=cv.TimePeriod(microseconds=7500), max=cv.TimePeriod(seconds=4)),
+    )
+    return cv.All(
+        cv.Schema(
+            {
+                cv.Optional(CONF_MIN_INTERVAL, default=min_interval): interval,
+                cv.Optional(CONF_MAX_INTERVAL, default=max_interval): interval,
+                cv.Optional(CONF_LATENCY, default=latency): cv.int_range(min=0, max=499),
+                cv.Optional(CONF_TIMEOUT, default=timeout): cv.All(
+                    cv.positive_time_period_milliseconds,
+                    cv.Range(min=cv.TimePeriod(milliseconds=100), max=cv.TimePeriod(seconds=32)),
+                ),
+            }
+        ),
+        _validate_conn_params,
+    )
+
+
+def _conn_params_args(config):
+    # controller units: 1.25 ms for intervals, 10 ms for the supervision timeout
+    return (
+        config[CONF_MIN_INTERVAL].total_microseconds // 1250,
+        config[CONF_MAX_INTERVAL].total_microseconds // 1250,
+        config[CONF_LATENCY],
+        config[CONF_TIMEOUT].total_milliseconds // 10,
+    )
+
+
+KEEP_WARM_SCHEMA = cv.Schema(
     {
-        cv.GenerateID(): cv.declare_id(BLENUSClientComponent),
-        cv.Optional(CONF_SERVICE_UUID, default="6E400001-B5A3-F393-E0A9-E50E24DCCA9E"): _uuid_128,
-        cv.Optional(CONF_RX_UUID, default="6E400002-B5A3-F393-E0A9-E50E24DCCA9E"): _uuid_128,
-        cv.Optional(CONF_TX_UUID, default="6E400003-B5A3-F393-E0A9-E50E24DCCA9E"): _uuid_128,
-        cv.Required(CONF_PIN): cv.int_range(min=0, max=999999),
-        cv.Optional(CONF_MTU, default=247): cv.int_range(min=23, max=517),
-        cv.Optional(CONF_IDLE_TIMEOUT, default="0s"): cv.positive_time_period_milliseconds,
-        cv.Optional(CONF_CONNECT_ON_DEMAND, default=False): cv.boolean,
-        cv.Optional(CONF_ON_CONNECTED): automation.validate_automation(),
-        cv.Optional(CONF_ON_DISCONNECTED): automation.validate_automation(),
-        cv.Optional(CONF_ON_SENT): automation.validate_automation(),
-        cv.Optional(CONF_ON_DATA): automation.validate_automation(),
+        cv.Optional(CONF_POLL_INTERVAL): cv.positive_not_null_time_period,
+        cv.Optional(CONF_LEAD_TIME, default="3s"): cv.positive_time_period_milliseconds,
     }
-).extend(ble_client.BLE_CLIENT_SCHEMA)
+)
+
+
+CONNECTION_PROFILES_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_BULK, default={}): _conn_params_schema("7.5ms", "15ms", 0, "2s"),
+        cv.Optional(CONF_IDLE, default={}): _conn_params_schema("100ms", "200ms", 4, "6s"),
+        cv.Optional(CONF_IDLE_DELAY, default="3s"): cv.positive_time_period_milliseconds,
+    }
+)
+
+
+FRAMING_SCHEMA = cv.Schema(
+    {
+        # clamped at runtime to what the RX buffer can hold
+        cv.Optional(CONF_MAX_FRAME_SIZE, default=65535): cv.int_range(min=1, max=65535),
+    }
+)
+
+
+def _validate_framing(config):
+    if CONF_ON_FRAME in config and CONF_FRAMING not in config:
+        raise cv.Invalid(f"{CONF_ON_FRAME} requires {CONF_FRAMING}")
+    return config
+
+
+def _delimiter(value):
+    if isinstance(value, str):
+        value = [ord(c) for c in value]
+    value = cv.ensure_list(cv.hex_uint8_t)(value)
+    if not 1 <= len(value) <= 8:
+        raise cv.Invalid(f"{CONF_DELIMITER} must be 1 to 8 bytes")
+    return value
+
+
+MESSAGE_SCHEMA = cv.Schema(
+    {
+        # 0s disables a bound; a message always ends at max_size, clamped at runtime to the RX buffer
+        cv.Optional(CONF_IDLE_GAP, default="20ms"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_MAX_SIZE, default=256): cv.int_range(min=1, max=65536),
+        cv.Optional(CONF_MAX_LATENCY, default="0s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_DELIMITER): _delimiter,
+    }
+)
+
+
+def _validate_messages(config):
+    if CONF_MESSAGE in config and CONF_ON_MESSAGE not in config:
+        raise cv.Invalid(f"{CONF_MESSAGE} requires {CONF_ON_MESSAGE}")
+    # both consume the RX stream, so only one of them can own it
+    if CONF_ON_MESSAGE in config and CONF_ON_FRAME in config:
+        raise cv.Invalid(f"{CONF_ON_MESSAGE} and {CONF_ON_FRAME} cannot be used together")
+    return config
+
+
+def _validate_scheduler(config):
+    if CONF_SESSION_TIMEOUT in config and CONF_SCHEDULER_ID not in config:
+        raise cv.Invalid(f"{CONF_SESSION_TIMEOUT} requires {CONF_SCHEDULER_ID}")
+    return config
+
+
+def _validate_rx_mode(config):
+    # indication pacing unsubscribes while the RX buffer cannot take one more payload, so it must hold one;
+    # a compressed payload decodes to up to LZ_MAX_CHUNK_INPUT bytes
+    if config[CONF_RX_MODE] == "notify":
+        return config
+    payload = config[CONF_MTU] - 3
+    if config[CONF_COMPRESSION]:
+        payload = max(payload, LZ_MAX_CHUNK_INPUT)
+    if config[CONF_RX_BUFFER_SIZE] < payload:
+        raise cv.Invalid(
+            f"{CONF_RX_MODE}: {config[CONF_RX_MODE]} needs {CONF_RX_BUFFER_SIZE} of at least {payload} bytes "
+            + ("(one decompressed payload)" if config[CONF_COMPRESSION] else f"({CONF_MTU} - 3)")
+        )
+    return config
+
+
+def _validate_watermarks(config):
+    # pausing needs a high watermark to trigger on
+    if config[CONF_RX_OVERFLOW_POLICY] == "pause" and CONF_HIGH_WATERMARK not in config:
+        config[CONF_HIGH_WATERMARK] = 0.75
+    if CONF_HIGH_WATERMARK in config and config[CONF_LOW_WATERMARK] >= config[CONF_HIGH_WATERMARK]:
+        raise cv.Invalid(f"{CONF_LOW_WATERMARK} must be below {CONF_HIGH_WATERMARK}")
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(BLENUSClientComponent),
+            cv.Optional(CONF_SERVICE_UUID, default="6E400001-B5A3-F393-E0A9-E50E24DCCA9E"): _uuid_128,
+            cv.Optional(CONF_RX_UUID, default="6E400002-B5A3-F393-E0A9-E50E24DCCA9E"): _uuid_128,
+            cv.Optional(CONF_TX_UUID, default="6E400003-B5A3-F393-E0A9-E50E24DCCA9E"): _uuid_128,
+            cv.Optional(CONF_PIN): cv.int_range(min=0, max=999999),
+            cv.Optional(CONF_SECURITY, default="passkey_bond"): cv.enum(SECURITY_MODES, lower=True),
+            cv.Optional(CONF_MTU, default=247): cv.int_range(min=23, max=517),
+            cv.Optional(CONF_IDLE_TIMEOUT, default="0s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_FLUSH_TIMEOUT, default="2s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_RX_BUFFER_SIZE, default=512): cv.int_range(min=64, max=65536),
+            cv.Optional(CONF_TX_BUFFER_SIZE, default=512): cv.int_range(min=64, max=65536),
+            cv.Optional(CONF_BUFFERS_IN_PSRAM, default=False): cv.boolean,
+            cv.Optional(CONF_HIGH_WATERMARK): cv.percentage,
+            cv.Optional(CONF_LOW_WATERMARK, default="25%"): cv.percentage,
+            cv.Optional(CONF_FRAMING): FRAMING_SCHEMA,
+            cv.Optional(CONF_MESSAGE): MESSAGE_SCHEMA,
+            cv.Optional(CONF_COMPRESSION, default=False): cv.boolean,
+            cv.Optional(CONF_RX_OVERFLOW_POLICY, default="drop_newest"): cv.enum(RX_OVERFLOW_POLICIES, lower=True),
+            cv.Optional(CONF_CONNECT_ON_DEMAND, default=False): cv.boolean,
+            cv.Optional(CONF_SCHEDULER_ID): cv.use_id(BLENUSScheduler),
+            cv.Optional(CONF_SESSION_TIMEOUT): cv.positive_not_null_time_period,
+            cv.Optional(CONF_KEEP_WARM): KEEP_WARM_SCHEMA,
+            cv.Optional(CONF_WRITE_MODE, default="response"): cv.enum(WRITE_MODES, lower=True),
+            cv.Optional(CONF_RX_MODE, default="notify"): cv.enum(RX_MODES, lower=True),
+            cv.Optional(CONF_TX_CREDITS, default=4): cv.int_range(min=1, max=32),
+            cv.Optional(CONF_MAX_OUTSTANDING_REQUESTS, default=1): cv.int_range(min=1, max=16),
+            cv.Optional(CONF_CONNECTION_PROFILES): CONNECTION_PROFILES_SCHEMA,
+            cv.Optional(CONF_CACHE_HANDLES, default=False): cv.boolean,
+            cv.Optional(CONF_PHY, default="1m"): cv.one_of("1m", "2m", lower=True),
+            cv.Optional(CONF_DATA_LENGTH): _data_length,
+            cv.Optional(CONF_ON_CONNECTED): automation.validate_automation(),
+            cv.Optional(CONF_ON_DISCONNECTED): automation.validate_automation(),
+            cv.Optional(CONF_ON_SENT): automation.validate_automation(),
+            cv.Optional(CONF_ON_DATA): automation.validate_automation(),
+            cv.Optional(CONF_ON_FLUSH_COMPLETE): automation.validate_automation(),
+            cv.Optional(CONF_ON_RX_HIGH_WATERMARK): automation.validate_automation(),
+            cv.Optional(CONF_ON_FRAME): automation.validate_automation(),
+            cv.Optional(CONF_ON_MESSAGE): automation.validate_automation(),
+        }
+    ).extend(ble_client.BLE_CLIENT_SCHEMA),
+    _validate_security,
+    _validate_rx_mode,
+    _validate_watermarks,
+    _validate_framing,
+    _validate_messages,
+    _validate_scheduler,
+)
 
 
 async def to_code(config):
@@ -73,10 +322,48 @@ async def to_code(config):
     cg.add(var.set_service_uuid(config[CONF_SERVICE_UUID]))
     cg.add(var.set_rx_uuid(config[CONF_RX_UUID]))
     cg.add(var.set_tx_uuid(config[CONF_TX_UUID]))
-    cg.add(var.set_passkey(config[CONF_PIN]))
+    cg.add(var.set_security_mode(config[CONF_SECURITY]))
+    if CONF_PIN in config:
+        cg.add(var.set_passkey(config[CONF_PIN]))
     cg.add(var.set_mtu(config[CONF_MTU]))
     cg.add(var.set_idle_disconnect_timeout(config[CONF_IDLE_TIMEOUT]))
+    cg.add(var.set_flush_timeout(config[CONF_FLUSH_TIMEOUT]))
+    cg.add(var.set_rx_buffer_size(config[CONF_RX_BUFFER_SIZE]))
+    cg.add(var.set_tx_buffer_size(config[CONF_TX_BUFFER_SIZE]))
+    cg.add(var.set_buffers_in_psram(config[CONF_BUFFERS_IN_PSRAM]))
+    cg.add(var.set_rx_overflow_policy(config[CONF_RX_OVERFLOW_POLICY]))
+    cg.add(var.set_compression(config[CONF_COMPRESSION]))
+    if CONF_FRAMING in config:
+        cg.add(var.set_framing(config[CONF_FRAMING][CONF_MAX_FRAME_SIZE]))
+    if CONF_HIGH_WATERMARK in config:
+        cg.add(
+            var.set_watermarks(
+                int(round(config[CONF_HIGH_WATERMARK] * 100)),
+                int(round(config[CONF_LOW_WATERMARK] * 100)),
+            )
+        )
     cg.add(var.set_connect_on_demand(config[CONF_CONNECT_ON_DEMAND]))
+    if CONF_SCHEDULER_ID in config:
+        scheduler = await cg.get_variable(config[CONF_SCHEDULER_ID])
+        session_timeout = config.get(CONF_SESSION_TIMEOUT)
+        cg.add(var.set_scheduler(scheduler, session_timeout.total_milliseconds if session_timeout else 0))
+    cg.add(var.set_write_mode(config[CONF_WRITE_MODE]))
+    cg.add(var.set_rx_mode(config[CONF_RX_MODE]))
+    if CONF_KEEP_WARM in config:
+        keep_warm = config[CONF_KEEP_WARM]
+        interval = keep_warm[CONF_POLL_INTERVAL].total_milliseconds if CONF_POLL_INTERVAL in keep_warm else 0
+        cg.add(var.set_keep_warm(interval, keep_warm[CONF_LEAD_TIME]))
+    cg.add(var.set_tx_credits(config[CONF_TX_CREDITS]))
+    cg.add(var.set_max_outstanding_requests(config[CONF_MAX_OUTSTANDING_REQUESTS]))
+    cg.add(var.set_cache_handles(config[CONF_CACHE_HANDLES]))
+    cg.add(var.set_prefer_2m_phy(config[CONF_PHY] == "2m"))
+    if CONF_DATA_LENGTH in config:
+        cg.add(var.set_data_length(config[CONF_DATA_LENGTH]))
+    if CONF_CONNECTION_PROFILES in config:
+        profiles = config[CONF_CONNECTION_PROFILES]
+        cg.add(var.set_bulk_conn_params(*_conn_params_args(profiles[CONF_BULK])))
+        cg.add(var.set_idle_conn_params(*_conn_params_args(profiles[CONF_IDLE])))
+        cg.add(var.set_conn_profile_idle_delay(profiles[CONF_IDLE_DELAY]))
 
     if CONF_ON_CONNECTED in config:
         for conf in config[CONF_ON_CONNECTED]:
@@ -94,6 +381,36 @@ async def to_code(config):
         for conf in config[CONF_ON_DATA]:
             await automation.build_automation(var.get_on_data_trigger(), [], conf)
 
+    if CONF_ON_FLUSH_COMPLETE in config:
+        for conf in config[CONF_ON_FLUSH_COMPLETE]:
+            await automation.build_automation(var.get_on_flush_complete_trigger(), [(cg.bool_, "success")], conf)
+
+    if CONF_ON_RX_HIGH_WATERMARK in config:
+        for conf in config[CONF_ON_RX_HIGH_WATERMARK]:
+            await automation.build_automation(var.get_on_rx_high_watermark_trigger(), [], conf)
+
+    if CONF_ON_FRAME in config:
+        cg.add(var.set_frame_dispatch(True))
+        for conf in config[CONF_ON_FRAME]:
+            await automation.build_automation(
+                var.get_on_frame_trigger(), [(cg.std_vector.template(cg.uint8), "frame")], conf
+            )
+
+    if CONF_ON_MESSAGE in config:
+        message = config.get(CONF_MESSAGE, MESSAGE_SCHEMA({}))
+        cg.add(
+            var.set_message_dispatch(
+                message[CONF_IDLE_GAP],
+                message[CONF_MAX_SIZE],
+                message[CONF_MAX_LATENCY],
+                message.get(CONF_DELIMITER, []),
+            )
+        )
+        for conf in config[CONF_ON_MESSAGE]:
+            await automation.build_automation(
+                var.get_on_message_trigger(), [(cg.std_vector.template(cg.uint8), "data")], conf
+            )
+
 
 @automation.register_action(CONNECT_ACTION, BLENUSClientConnectAction, automation.maybe_simple_id({cv.GenerateID(): cv.use_id(BLENUSClientComponent)}), synchronous=True)
 async def ble_nus_client_connect_to_code(config, action_id, template_arg, args):
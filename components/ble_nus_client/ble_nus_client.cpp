@@ -1,22 +1,203 @@
 #include "ble_nus_client.h"
 
+#include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
+#include "esphome/components/ble_nus_common/blocking_flush.h"
+#include "esphome/components/ble_nus_common/ring_factory.h"
+#include "esphome/components/ble_nus_common/tx_chunker.h"
+
+#include <cmath>
+#include <cstring>
 
 namespace esphome {
 namespace ble_nus_client {
 
 static const char *const TAG = "ble_nus_client";
 
+// ESP_BLE_GAP_PHY_1M / _2M / _CODED
+static const char *phy_to_str(uint8_t phy) {
+  switch (phy) {
+    case 1:
+      return "1M";
+    case 2:
+      return "2M";
+    case 3:
+      return "Coded";
+    default:
+      return "unknown";
+  }
+}
+
 void BLENUSClientComponent::setup() {
-  this->rx_buffer_ = esphome::ring_buffer::RingBuffer::create(RX_BUFFER_CAPACITY);
-  this->tx_buffer_ = esphome::ring_buffer::RingBuffer::create(TX_BUFFER_CAPACITY);
-  this->peek_valid_ = false;
+  this->rx_buffer_ = ble_nus_common::create_byte_ring(this->rx_buffer_size_, this->buffers_in_psram_);
+  this->tx_buffer_ = ble_nus_common::create_byte_ring(this->tx_buffer_size_, this->buffers_in_psram_);
+  if (this->rx_buffer_ == nullptr || this->tx_buffer_ == nullptr) {
+    ESP_LOGE(TAG, "Failed to allocate RX/TX buffers (%zu/%zu bytes)", this->rx_buffer_size_, this->tx_buffer_size_);
+    this->mark_failed();
+    return;
+  }
+  if (this->high_watermark_pct_ > 0) {
+    this->rx_watermark_.configure(this->rx_buffer_size_ * this->high_watermark_pct_ / 100,
+                                  this->rx_buffer_size_ * this->low_watermark_pct_ / 100);
+    this->tx_watermark_.configure(this->tx_buffer_size_ * this->high_watermark_pct_ / 100,
+                                  this->tx_buffer_size_ * this->low_watermark_pct_ / 100);
+  }
+  if (this->framing_) {
+    this->max_frame_size_ = std::min(this->max_frame_size_, this->rx_buffer_size_ - ble_nus_common::FRAME_OVERHEAD);
+  }
+  this->rx_messages_.clamp_max_size(this->rx_buffer_size_);
+  this->tx_chunk_ = std::make_unique<uint8_t[]>(MAX_CHUNK_PAYLOAD);
+  if (this->compression_) {
+    this->tx_raw_ = std::make_unique<uint8_t[]>(COMPRESS_INPUT_MAX);
+  }
   this->set_state_(FsmState::IDLE);
+  if (this->scheduler_ != nullptr) {
+    this->scheduler_->register_link(this, this->session_timeout_ms_);
+  }
+  if (this->cache_handles_ && this->parent_ != nullptr) {
+    uint32_t hash = fnv1_hash(str_sprintf("ble_nus_client_%012llx_%s", (unsigned long long) this->parent_->get_address(),
+                                          this->service_uuid_.to_string().c_str()));
+    this->handle_cache_pref_ = global_preferences->make_preference<HandleCache>(hash, true);
+    if (!this->handle_cache_pref_.load(&this->handle_cache_)) {
+      this->handle_cache_ = {};
+    }
+  }
+#ifdef USE_SENSOR
+  if (this->stats_update_interval_ms_ > 0) {
+    this->set_interval("stats", this->stats_update_interval_ms_, [this]() { this->publish_stats_(); });
+  }
+#endif
 }
 
-void BLENUSClientComponent::loop() { this->handle_state_(); }
+void BLENUSClientComponent::loop() {
+  this->drain_ble_work_();
+  this->handle_state_();
+  this->check_flush_();
+  if (this->message_dispatch_ && this->requests_.sent() == 0) {
+    // idle gap and latency bound expire here; delimiters and max_size are caught as notifications arrive.
+    // While requests are outstanding the stream is theirs, as on the notification path
+    this->dispatch_messages_();
+  }
+  this->check_requests_();
+  this->sleep_until_needed_();
+}
 
-void BLENUSClientComponent::dump_config() { ESP_LOGCONFIG(TAG, "BLE NUS Client"); }
+void BLENUSClientComponent::sleep_until_needed_() {
+  // everything loop() does is either a reaction to an event that re-enables it (BLE callbacks, UART access,
+  // connect()/disconnect(), posted work) or a deadline; sleep until the nearest deadline
+  if (this->ble_work_pending_.load(std::memory_order_acquire) != 0) {
+    return;
+  }
+  const uint32_t now = millis();
+  uint32_t wait = UINT32_MAX;
+  auto until = [now, &wait](uint32_t deadline) {
+    const int32_t left = static_cast<int32_t>(deadline - now);
+    wait = std::min<uint32_t>(wait, left > 0 ? left : 0);
+  };
+  switch (this->state_) {
+    case FsmState::IDLE:
+      if (this->keep_warm_enabled_ && !this->keep_warm_fired_ && this->keep_warm_interval_ms_ != 0 &&
+          this->last_burst_ms_ != 0) {
+        until(this->last_burst_ms_ + this->keep_warm_interval_ms_ -
+              std::min(this->keep_warm_lead_ms_, this->keep_warm_interval_ms_));
+      }
+      break;
+    case FsmState::UART_LINK_ESTABLISHED:
+      if (this->compression_state_ == CompressionState::NEGOTIATING) {
+        until(this->compression_request_ms_ + COMPRESSION_ANSWER_TIMEOUT_MS);
+      }
+      if (this->idle_disconnect_timeout_ms_ > 0) {
+        until(this->last_activity_ms_ + this->idle_disconnect_timeout_ms_ + 1);
+      }
+      if (this->conn_profiles_enabled_) {
+        if (this->conn_profile_pending_) {
+          until(this->conn_profile_request_ms_ + CONN_PROFILE_RETRY_MS);
+        } else if (this->conn_profile_ != ConnProfile::IDLE && !this->data_queued_()) {
+          // while data is queued the profile stays bulk until a BLE event or UART access changes that
+          until(this->last_activity_ms_ + this->conn_profile_idle_delay_ms_);
+        }
+      }
+      break;
+    default:
+      // bring-up and teardown advance on GATTC/GAP events, bounded by the watchdog
+      until(this->state_enter_ms_ + this->state_timeout_ms_ + 1);
+      break;
+  }
+  if (this->flush_pending_) {
+    until(this->flush_started_ms_ + this->tx_flush_timeout_ms_ + 1);
+  }
+  uint32_t message_deadline;
+  if (this->message_dispatch_ && this->requests_.sent() == 0 && this->rx_messages_.next_deadline(&message_deadline)) {
+    until(message_deadline);
+  }
+  uint32_t request_deadline;
+  if (this->requests_.next_deadline(&request_deadline)) {
+    until(request_deadline);
+  }
+  if (wait == 0) {
+    return;
+  }
+  this->disable_loop();
+  if (wait != UINT32_MAX) {
+    this->set_timeout("wake", wait, [this]() { this->enable_loop(); });
+  }
+}
+
+void BLENUSClientComponent::dump_config() {
+  ESP_LOGCONFIG(TAG, "BLE NUS Client");
+  ESP_LOGCONFIG(TAG, "  Buffers: RX %zu / TX %zu bytes%s", this->rx_buffer_size_, this->tx_buffer_size_,
+                this->buffers_in_psram_ ? " (PSRAM preferred)" : "");
+  if (this->high_watermark_pct_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Watermarks: high %u%%, low %u%%", this->high_watermark_pct_, this->low_watermark_pct_);
+  }
+  ESP_LOGCONFIG(TAG, "  RX overflow policy: %s", ble_nus_common::rx_overflow_policy_to_str(this->rx_overflow_policy_));
+  if (this->compression_) {
+    ESP_LOGCONFIG(TAG, "  Compression: LZ v%u, negotiated per link", ble_nus_common::LZ_VERSION);
+  }
+  if (this->framing_) {
+    ESP_LOGCONFIG(TAG, "  Framing: up to %zu byte payloads%s", this->max_frame_size_,
+                  this->frame_dispatch_ ? ", delivered via on_frame" : "");
+  }
+  if (this->message_dispatch_) {
+    ESP_LOGCONFIG(TAG, "  Messages: up to %zu bytes, idle gap %u ms, max latency %u ms, %zu byte delimiter",
+                  this->rx_messages_.max_size(), this->rx_messages_.idle_gap_ms(), this->rx_messages_.max_latency_ms(),
+                  this->rx_messages_.delimiter_len());
+  }
+  if (this->requests_.max_outstanding() > 1) {
+    ESP_LOGCONFIG(TAG, "  Requests: up to %u outstanding", this->requests_.max_outstanding());
+  }
+  ESP_LOGCONFIG(TAG, "  RX mode: %s", this->rx_mode_ == RxMode::INDICATE ? "indicate"
+                                      : this->rx_mode_ == RxMode::AUTO   ? "auto"
+                                                                         : "notify");
+  if (this->write_mode_ == WriteMode::WITHOUT_RESPONSE) {
+    ESP_LOGCONFIG(TAG, "  Write mode: no_response (%u chunks in flight)", this->tx_credits_);
+  } else {
+    ESP_LOGCONFIG(TAG, "  Write mode: response");
+  }
+  if (this->desired_data_length_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Requested LL data length: %u octets", this->desired_data_length_);
+  }
+  if (this->prefer_2m_phy_) {
+#ifdef CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    ESP_LOGCONFIG(TAG, "  Preferred PHY: 2M");
+#else
+    ESP_LOGCONFIG(TAG, "  Preferred PHY: 2M (not supported by this chip, staying on 1M)");
+#endif
+  }
+  if (this->cache_handles_) {
+    ESP_LOGCONFIG(TAG, "  GATT handle cache: %s", this->handle_cache_.peer != 0 ? "primed" : "empty");
+  }
+  ESP_LOGCONFIG(TAG, "  Current link: PHY TX %s / RX %s, LL data length TX %u / RX %u octets",
+                phy_to_str(this->tx_phy_), phy_to_str(this->rx_phy_), this->ll_tx_octets_, this->ll_rx_octets_);
+  if (this->conn_profiles_enabled_) {
+    ESP_LOGCONFIG(TAG, "  Bulk connection interval: %.2f-%.2f ms, latency %u",
+                  this->bulk_conn_params_.min_interval * 1.25f, this->bulk_conn_params_.max_interval * 1.25f,
+                  this->bulk_conn_params_.latency);
+    ESP_LOGCONFIG(TAG, "  Idle connection interval: %.2f-%.2f ms, latency %u (after %u ms quiet)",
+                  this->idle_conn_params_.min_interval * 1.25f, this->idle_conn_params_.max_interval * 1.25f,
+                  this->idle_conn_params_.latency, this->conn_profile_idle_delay_ms_);
+  }
+}
 
 const LogString *BLENUSClientComponent::state_to_string(FsmState s) const {
   switch (s) {
@@ -40,6 +221,7 @@ const LogString *BLENUSClientComponent::state_to_string(FsmState s) const {
 }
 
 bool BLENUSClientComponent::connect() {
+  this->enable_loop();
   if (this->parent_ == nullptr) {
     ESP_LOGE(TAG, "BLE client parent not configured");
     this->set_state_(FsmState::ERROR);
@@ -50,6 +232,12 @@ bool BLENUSClientComponent::connect() {
     ESP_LOGV(TAG, "Connect requested but already connecting/connected (state=%d)", static_cast<int>(this->state_));
     return false;
   }
+  if (this->scheduler_ != nullptr && !this->slot_held_) {
+    // on_slot_granted() comes back here once a connection slot is free
+    ESP_LOGD(TAG, "Waiting for a connection slot");
+    this->scheduler_->request(this);
+    return false;
+  }
   ESP_LOGI(TAG, "Starting BLE connection");
 
   this->auth_completed_ = false;
@@ -61,16 +249,49 @@ bool BLENUSClientComponent::connect() {
   this->chr_commands_handle_ = 0;
   this->chr_responses_handle_ = 0;
   this->chr_cccd_handle_ = 0;
+  this->chr_compression_handle_ = 0;
+  this->handles_from_cache_ = false;
 
   // MTU
   ESP_LOGV(TAG, "Setting desired MTU to %d", this->desired_mtu_);
   esp_ble_gatt_set_local_mtu(this->desired_mtu_);
 
-  // Security parameters
-  esp_ble_auth_req_t auth_req = ESP_LE_AUTH_REQ_SC_MITM_BOND;
-  esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth_req, sizeof(uint8_t));
+  this->apply_security_params_();
+  // without security there is no pairing step to wait for
+  this->auth_completed_ = this->security_mode_ == SecurityMode::NONE;
+  this->resuming_bond_ = false;
+  this->connect_started_ms_ = millis();
 
-  esp_ble_io_cap_t iocap = ESP_IO_CAP_IN;
+  // Address type can be adjusted if needed
+  this->parent_->set_remote_addr_type(BLE_ADDR_TYPE_RANDOM);
+
+  this->set_state_(FsmState::CONNECTING);
+  this->parent_->connect();
+  return true;
+}
+
+void BLENUSClientComponent::apply_security_params_() {
+  if (this->security_mode_ == SecurityMode::NONE) {
+    return;
+  }
+  esp_ble_auth_req_t auth_req;
+  esp_ble_io_cap_t iocap;
+  switch (this->security_mode_) {
+    case SecurityMode::JUST_WORKS:
+      auth_req = ESP_LE_AUTH_REQ_SC_BOND;
+      iocap = ESP_IO_CAP_NONE;
+      break;
+    case SecurityMode::PASSKEY:
+      auth_req = ESP_LE_AUTH_REQ_SC_MITM;
+      iocap = ESP_IO_CAP_IN;
+      break;
+    case SecurityMode::PASSKEY_BOND:
+    default:
+      auth_req = ESP_LE_AUTH_REQ_SC_MITM_BOND;
+      iocap = ESP_IO_CAP_IN;
+      break;
+  }
+  esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth_req, sizeof(uint8_t));
   esp_ble_gap_set_security_param(ESP_BLE_SM_IOCAP_MODE, &iocap, sizeof(uint8_t));
 
   uint8_t key_size = 16;
@@ -84,13 +305,43 @@ bool BLENUSClientComponent::connect() {
 
   uint8_t resp_key = ESP_BLE_ID_KEY_MASK;
   esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY, &resp_key, sizeof(resp_key));
+}
 
-  // Address type can be adjusted if needed
-  this->parent_->set_remote_addr_type(BLE_ADDR_TYPE_RANDOM);
+bool BLENUSClientComponent::is_peer_bonded_() {
+  int count = esp_ble_get_bond_device_num();
+  if (count <= 0) {
+    return false;
+  }
+  std::vector<esp_ble_bond_dev_t> bonded(count);
+  if (esp_ble_get_bond_device_list(&count, bonded.data()) != ESP_OK) {
+    return false;
+  }
+  for (int i = 0; i < count; i++) {
+    if (this->parent_->check_addr(bonded[i].bd_addr)) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  this->set_state_(FsmState::CONNECTING);
-  this->parent_->connect();
-  return true;
+void BLENUSClientComponent::start_encryption_() {
+  if (this->security_mode_ == SecurityMode::NONE) {
+    return;
+  }
+  // initiate from our side instead of waiting for the peripheral's security request; with stored keys this is
+  // a plain LTK re-encryption and no pairing exchange takes place
+  esp_ble_sec_act_t action;
+  if (this->is_peer_bonded_()) {
+    this->resuming_bond_ = true;
+    action = ESP_BLE_SEC_ENCRYPT;
+    ESP_LOGD(TAG, "Peer is bonded, resuming encrypted session");
+  } else {
+    action = this->security_mode_ == SecurityMode::JUST_WORKS ? ESP_BLE_SEC_ENCRYPT_NO_MITM : ESP_BLE_SEC_ENCRYPT_MITM;
+  }
+  esp_err_t err = esp_ble_set_encryption(this->parent_->get_remote_bda(), action);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to start encryption: %d", err);
+  }
 }
 
 void BLENUSClientComponent::disconnect() {
@@ -106,18 +357,142 @@ void BLENUSClientComponent::write_array(const uint8_t *data, size_t len) {
   if (data == nullptr || len == 0 || this->tx_buffer_ == nullptr) {
     return;
   }
+  this->note_consumer_access_();
   if (this->state_ != FsmState::UART_LINK_ESTABLISHED) {
+    this->stats_.on_dropped(len);
     this->maybe_autoconnect_();
     return;
   }
   this->last_activity_ms_ = millis();
-  size_t written = this->tx_buffer_->write_without_replacement(data, len, 0, true);
+  size_t written = this->tx_buffer_->write(data, len);
   if (written < len) {
     ESP_LOGW(TAG, "TX buffer overflow, dropped %zu bytes", len - written);
+    this->stats_.on_dropped(len - written);
+  }
+  this->start_tx_();
+}
+
+bool BLENUSClientComponent::write_frame(const uint8_t *data, size_t len) {
+  this->note_consumer_access_();
+  if (this->state_ != FsmState::UART_LINK_ESTABLISHED) {
+    this->stats_.on_dropped(len);
+    this->maybe_autoconnect_();
+    return false;
+  }
+  if (this->tx_buffer_ == nullptr || !ble_nus_common::push_frame(*this->tx_buffer_, data, len)) {
+    ESP_LOGW(TAG, "No room for a %zu byte frame in the TX buffer", len);
+    return false;
+  }
+  this->last_activity_ms_ = millis();
+  this->start_tx_();
+  return true;
+}
+
+void BLENUSClientComponent::store_rx_chunk_(const uint8_t *data, size_t len) {
+  size_t lost = 0;
+  if (this->compression_state_ == CompressionState::ACTIVE) {
+    size_t raw = 0;
+    const bool ok = this->rx_decoder_.decode_chunk(data, len, [this, &lost, &raw](const uint8_t *out, size_t n) {
+      raw += n;
+      lost += ble_nus_common::store_rx(*this->rx_buffer_, out, n, this->rx_overflow_policy_);
+    });
+    this->stats_.on_compressed(raw, len);
+    if (!ok) {
+      ESP_LOGE(TAG, "Malformed compressed chunk, reconnecting to resynchronise");
+      this->disconnect();
+    }
+  } else {
+    lost = ble_nus_common::store_rx(*this->rx_buffer_, data, len, this->rx_overflow_policy_);
   }
+  if (lost > 0) {
+    ESP_LOGW(TAG, "RX buffer overflow, dropped %zu bytes", lost);
+    this->stats_.on_dropped(lost);
+    if (this->rx_overflow_policy_ == ble_nus_common::RxOverflowPolicy::DROP_OLDEST) {
+      this->on_rx_consumed_();
+    }
+  }
+}
+
+void BLENUSClientComponent::start_compression_() {
+  this->compression_state_ = CompressionState::OFF;
+  if (!this->compression_ || this->tx_raw_ == nullptr) {
+    return;
+  }
+  if (this->chr_compression_handle_ == 0) {
+    ESP_LOGD(TAG, "Peer does not offer compression");
+    return;
+  }
+  esp_err_t err = esp_ble_gattc_read_char(this->parent_->get_gattc_if(), this->parent_->get_conn_id(),
+                                          this->chr_compression_handle_, ESP_GATT_AUTH_REQ_NONE);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to read compression characteristic: %d", err);
+    return;
+  }
+  this->compression_state_ = CompressionState::NEGOTIATING;
+  this->compression_request_ms_ = millis();
+}
+
+void BLENUSClientComponent::on_compression_read_(esp_gatt_status_t status, const uint8_t *value, uint16_t len) {
+  if (this->compression_state_ != CompressionState::NEGOTIATING) {
+    return;
+  }
+  if (status != ESP_GATT_OK || len != 1 || value[0] != ble_nus_common::LZ_VERSION) {
+    ESP_LOGD(TAG, "Peer offers an unsupported compression version, continuing uncompressed");
+    this->compression_state_ = CompressionState::OFF;
+    this->start_tx_();
+    return;
+  }
+  uint8_t version = ble_nus_common::LZ_VERSION;
+  esp_err_t err =
+      esp_ble_gattc_write_char(this->parent_->get_gattc_if(), this->parent_->get_conn_id(),
+                               this->chr_compression_handle_, 1, &version, ESP_GATT_WRITE_TYPE_RSP,
+                               ESP_GATT_AUTH_REQ_NONE);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to enable compression: %d", err);
+    this->compression_state_ = CompressionState::OFF;
+    this->start_tx_();
+  }
+}
+
+void BLENUSClientComponent::on_compression_write_(esp_gatt_status_t status) {
+  if (this->compression_state_ != CompressionState::NEGOTIATING) {
+    if (status == ESP_GATT_OK) {
+      // the peer switched formats after we gave up waiting; the two ends no longer agree
+      ESP_LOGW(TAG, "Late compression answer, reconnecting to resynchronise");
+      this->disconnect();
+    }
+    return;
+  }
+  if (status == ESP_GATT_OK) {
+    ESP_LOGD(TAG, "Compression enabled by peer");
+    this->tx_encoder_.reset();
+    this->rx_decoder_.reset();
+    this->compression_state_ = CompressionState::ACTIVE;
+  } else {
+    ESP_LOGD(TAG, "Peer declined compression: status=%d", status);
+    this->compression_state_ = CompressionState::OFF;
+  }
+  this->start_tx_();
+}
+
+void BLENUSClientComponent::check_compression_() {
+  if (this->compression_state_ != CompressionState::NEGOTIATING ||
+      millis() - this->compression_request_ms_ < COMPRESSION_ANSWER_TIMEOUT_MS) {
+    return;
+  }
+  ESP_LOGW(TAG, "No compression answer from peer, continuing uncompressed");
+  this->compression_state_ = CompressionState::OFF;
+  this->start_tx_();
+}
+
+void BLENUSClientComponent::start_tx_() {
+  this->track_tx_level_();
+  this->update_conn_profile_();
   if (!this->tx_in_progress_ && this->state_ == FsmState::UART_LINK_ESTABLISHED) {
     this->tx_in_progress_ = true;
-    this->defer_in_ble_([this]() { this->send_next_chunk_in_ble_(); });
+    this->post_ble_work_(BLE_WORK_SEND_CHUNK);
+    // UART consumers run in the main loop, same as the BLE dispatcher: kick the TX chain right away
+    this->drain_ble_work_();
   }
 }
 
@@ -126,27 +501,14 @@ void BLENUSClientComponent::write_byte(uint8_t data) { this->write_array(&data,
 bool BLENUSClientComponent::read_byte(uint8_t *data) { return this->read_array(data, 1); }
 
 bool BLENUSClientComponent::peek_byte(uint8_t *data) {
+  this->note_consumer_access_();
   if (this->state_ != FsmState::UART_LINK_ESTABLISHED) {
     this->maybe_autoconnect_();
   }
-  if (this->peek_valid_) {
-    if (data != nullptr) {
-      *data = this->peek_byte_;
-    }
-    this->last_activity_ms_ = millis();
-    return true;
-  }
-
-  if (this->rx_buffer_ == nullptr || this->rx_buffer_->available() == 0) {
-    return false;
-  }
   uint8_t tmp{0};
-  size_t read = this->rx_buffer_->read(&tmp, 1, 0);
-  if (read == 0) {
+  if (this->rx_buffer_ == nullptr || !this->rx_buffer_->peek_byte(&tmp)) {
     return false;
   }
-  this->peek_byte_ = tmp;
-  this->peek_valid_ = true;
   if (data != nullptr) {
     *data = tmp;
   }
@@ -155,64 +517,306 @@ bool BLENUSClientComponent::peek_byte(uint8_t *data) {
 }
 
 bool BLENUSClientComponent::read_array(uint8_t *data, size_t len) {
+  this->note_consumer_access_();
   if (this->state_ != FsmState::UART_LINK_ESTABLISHED) {
     this->maybe_autoconnect_();
   }
   if (data == nullptr || len == 0) {
     return true;
   }
-  size_t remaining = len;
-  size_t offset = 0;
-
-  if (this->peek_valid_) {
-    data[0] = this->peek_byte_;
-    this->peek_valid_ = false;
-    remaining--;
-    offset = 1;
+  // all-or-nothing: a short read leaves the ring untouched
+  if (this->rx_buffer_ == nullptr || this->rx_buffer_->available() < len) {
+    return false;
   }
+  this->rx_buffer_->read(data, len);
+  this->on_rx_consumed_();
+  this->track_rx_level_();
+  this->last_activity_ms_ = millis();
+  return true;
+}
 
-  if (remaining == 0) {
-    return true;
+bool BLENUSClientComponent::read_frame(std::vector<uint8_t> &frame) {
+  this->note_consumer_access_();
+  if (this->state_ != FsmState::UART_LINK_ESTABLISHED) {
+    this->maybe_autoconnect_();
   }
+  return this->pop_frame_(frame);
+}
 
-  if (this->rx_buffer_ == nullptr || this->rx_buffer_->available() < remaining) {
-    // restore peek_valid_? we already consumed it; treat as failure but keep consumed byte
+bool BLENUSClientComponent::pop_frame_(std::vector<uint8_t> &frame) {
+  if (!this->framing_ || this->rx_buffer_ == nullptr) {
     return false;
   }
+  size_t skipped = 0;
+  const bool found = ble_nus_common::pop_frame(*this->rx_buffer_, this->max_frame_size_, frame, skipped);
+  if (skipped > 0) {
+    ESP_LOGW(TAG, "Discarded %zu bytes outside valid frames", skipped);
+    this->stats_.on_frame_error(skipped);
+  }
+  if (found || skipped > 0) {
+    this->on_rx_consumed_();
+    this->track_rx_level_();
+    this->last_activity_ms_ = millis();
+  }
+  return found;
+}
+
+void BLENUSClientComponent::dispatch_frames_() {
+  std::vector<uint8_t> frame;
+  while (this->pop_frame_(frame)) {
+    this->on_frame_.trigger(frame);
+  }
+}
 
-  size_t read = this->rx_buffer_->read(data + offset, remaining, 0);
-  if (read == remaining) {
+void BLENUSClientComponent::dispatch_messages_() {
+  if (this->rx_buffer_ == nullptr) {
+    return;
+  }
+  std::vector<uint8_t> message;
+  while (this->rx_messages_.pop(*this->rx_buffer_, millis(), message)) {
+    this->on_rx_consumed_();
+    this->track_rx_level_();
     this->last_activity_ms_ = millis();
-    return true;
+    this->on_message_.trigger(message);
   }
-  return false;
 }
 
 size_t BLENUSClientComponent::available() {
+  this->note_consumer_access_();
   if (this->state_ != FsmState::UART_LINK_ESTABLISHED) {
     this->maybe_autoconnect_();
   }
   if (this->rx_buffer_ == nullptr) {
     return 0;
   }
-  return this->rx_buffer_->available() + (this->peek_valid_ ? 1 : 0);
+  return this->rx_buffer_->available();
 }
 
 uart::UARTFlushResult BLENUSClientComponent::flush() {
+  this->note_consumer_access_();
   if (this->state_ != FsmState::UART_LINK_ESTABLISHED) {
     this->maybe_autoconnect_();
   }
-  const uint32_t start = millis();
-  while (this->tx_in_progress_ || (this->tx_buffer_ != nullptr && this->tx_buffer_->available() > 0)) {
-    if (millis() - start > this->tx_flush_timeout_ms_) {
-      ESP_LOGW(TAG, "Flush timeout (%u ms) with %zu bytes pending", this->tx_flush_timeout_ms_,
-               this->tx_buffer_ != nullptr ? this->tx_buffer_->available() : 0);
+  if (this->tx_idle_()) {
+    return uart::UARTFlushResult::UART_FLUSH_RESULT_SUCCESS;
+  }
+  if (!ble_nus_common::wait_tx_drained(
+          this->tx_flush_timeout_ms_, [this]() { return this->tx_idle_(); }, [this]() { this->drain_ble_work_(); })) {
+    // called from a BLE event: cannot wait here, so complete asynchronously through on_flush_complete
+    this->flush_async(nullptr);
+    return uart::UARTFlushResult::UART_FLUSH_RESULT_ASSUMED_SUCCESS;
+  }
+  this->check_flush_();
+  if (!this->tx_idle_()) {
+    ESP_LOGW(TAG, "Flush timeout (%u ms) with %zu bytes pending", this->tx_flush_timeout_ms_,
+             this->tx_buffer_ != nullptr ? this->tx_buffer_->available() : 0);
+    return uart::UARTFlushResult::UART_FLUSH_RESULT_TIMEOUT;
+  }
+  return uart::UARTFlushResult::UART_FLUSH_RESULT_SUCCESS;
+}
+
+void BLENUSClientComponent::flush_async(std::function<void(bool)> &&callback) {
+  if (callback) {
+    this->flush_callbacks_.push_back(std::move(callback));
+  }
+  if (!this->flush_pending_) {
+    this->flush_pending_ = true;
+    this->flush_started_ms_ = millis();
+  }
+  this->check_flush_();
+}
+
+bool BLENUSClientComponent::send_request(std::vector<uint8_t> data, ble_nus_common::ResponseMatcher matcher,
+                                         uint32_t timeout_ms, RequestCallback &&callback) {
+  if (data.size() > this->tx_buffer_size_) {
+    ESP_LOGW(TAG, "Request of %zu bytes exceeds the TX buffer (%zu bytes)", data.size(), this->tx_buffer_size_);
+    return false;
+  }
+  this->enable_loop();
+  this->requests_.push(std::move(data), std::move(matcher), timeout_ms, std::move(callback), millis());
+  this->send_requests_();
+  return true;
+}
+
+void BLENUSClientComponent::send_requests_() {
+  if (this->requests_.size() == this->requests_.sent()) {
+    return;
+  }
+  if (this->state_ != FsmState::UART_LINK_ESTABLISHED || this->tx_buffer_ == nullptr) {
+    // queued requests go out once the link is up
+    this->maybe_autoconnect_();
+    return;
+  }
+  while (const auto *request = this->requests_.next_unsent()) {
+    if (this->tx_buffer_->free() < request->data.size()) {
+      // whole requests only; the next TX completion runs loop() and retries
+      return;
+    }
+    std::vector<uint8_t> data = this->requests_.mark_sent();
+    this->write_array(data.data(), data.size());
+  }
+}
+
+void BLENUSClientComponent::match_requests_() {
+  if (this->rx_buffer_ == nullptr) {
+    return;
+  }
+  while (this->requests_.sent() > 0) {
+    const size_t len = this->requests_.match(*this->rx_buffer_);
+    if (len == 0) {
+      return;
+    }
+    std::vector<uint8_t> response(len);
+    this->rx_buffer_->read(response.data(), len);
+    this->on_rx_consumed_();
+    this->track_rx_level_();
+    this->last_activity_ms_ = millis();
+    ESP_LOGV(TAG, "Response of %zu bytes after %u ms", len, millis() - this->requests_.started_ms());
+    this->finish_request_(RequestResult::OK, response);
+  }
+}
+
+void BLENUSClientComponent::check_requests_() {
+  if (this->requests_.empty()) {
+    return;
+  }
+  this->send_requests_();
+  this->match_requests_();
+  const uint32_t now = millis();
+  if (!this->requests_.timed_out(now)) {
+    return;
+  }
+  const size_t sent = this->requests_.sent();
+  const size_t partial = this->rx_buffer_ != nullptr ? this->rx_buffer_->available() : 0;
+  ESP_LOGW(TAG, "Request timed out after %u ms (%zu sent, %zu bytes buffered)", now - this->requests_.started_ms(),
+           sent, partial);
+  auto failed = this->requests_.pop_timed_out(now);
+  if (sent > 0 && partial > 0) {
+    // the buffered bytes belong to the failed requests, and cannot be told apart from the next response
+    this->rx_buffer_->consume(partial);
+    this->on_rx_consumed_();
+    this->track_rx_level_();
+  }
+  this->fail_requests_(std::move(failed), RequestResult::TIMEOUT);
+}
+
+void BLENUSClientComponent::finish_request_(RequestResult result, const std::vector<uint8_t> &response) {
+  auto request = this->requests_.pop(millis());
+  // the next request goes out before the callback runs, so a slow callback does not add to its latency
+  this->send_requests_();
+  if (request.callback) {
+    request.callback(result, response);
+  }
+}
+
+void BLENUSClientComponent::fail_requests_(std::vector<ble_nus_common::RequestPipeline::Request> &&requests,
+                                           RequestResult result) {
+  // as in finish_request_(), queued requests go out before the callbacks run
+  this->send_requests_();
+  for (auto &request : requests) {
+    if (request.callback) {
+      request.callback(result, {});
+    }
+  }
+}
+
+void BLENUSClientComponent::on_rx_consumed_() {
+  // scan positions kept across calls point past the front of the ring, which has just moved
+  this->rx_messages_.on_consumed();
+  this->requests_.on_consumed();
+}
+
+void BLENUSClientComponent::track_rx_level_() {
+  const size_t level = this->rx_buffer_->available();
+  this->stats_.track_rx_level(level);
+  switch (this->rx_watermark_.update(level)) {
+    case ble_nus_common::Watermark::ROSE_ABOVE_HIGH:
+      ESP_LOGW(TAG, "RX buffer above high watermark (%zu/%zu bytes)", level, this->rx_buffer_size_);
+      this->on_rx_high_watermark_.trigger();
+      break;
+    case ble_nus_common::Watermark::FELL_BELOW_LOW:
+      ESP_LOGD(TAG, "RX buffer back below low watermark (%zu/%zu bytes)", level, this->rx_buffer_size_);
+      break;
+    default:
+      break;
+  }
+  this->update_rx_flow_();
+}
+
+void BLENUSClientComponent::update_rx_flow_() {
+  bool hold = this->rx_overflow_policy_ == ble_nus_common::RxOverflowPolicy::PAUSE && this->rx_watermark_.is_above();
+  if (this->rx_indicate_) {
+    // the stack confirms each indication as it arrives, so pacing happens here: unsubscribe before a full
+    // payload would no longer fit, resubscribe once two fit again (or the ring has drained). A compressed
+    // payload can decode to LZ_MAX_CHUNK_INPUT bytes. The config check keeps the ring at least one payload
+    // large; the cap only guarantees that an empty ring always resubscribes
+    size_t chunk = this->compression_state_ == CompressionState::ACTIVE ? ble_nus_common::LZ_MAX_CHUNK_INPUT
+                                                                         : (this->mtu_ > 3 ? this->mtu_ - 3 : 20);
+    chunk = std::min(chunk, this->rx_buffer_->capacity());
+    const size_t room = this->rx_buffer_->free();
+    hold = hold || room < chunk || (this->rx_paused_ && room < std::min(2 * chunk, this->rx_buffer_->capacity()));
+  }
+  if (hold != this->rx_paused_) {
+    this->set_rx_paused_(hold);
+  }
+}
+
+void BLENUSClientComponent::set_rx_paused_(bool paused) {
+  if (this->state_ != FsmState::UART_LINK_ESTABLISHED || this->chr_cccd_handle_ == 0) {
+    this->rx_paused_ = false;
+    return;
+  }
+  // the peer stops notifying while the CCCD is cleared, so nothing is lost while the consumer catches up
+  uint16_t cccd = paused ? 0x0000 : (this->rx_indicate_ ? 0x0002 : 0x0001);
+  auto err = esp_ble_gattc_write_char_descr(this->parent_->get_gattc_if(), this->parent_->get_conn_id(),
+                                            this->chr_cccd_handle_, sizeof(cccd), (uint8_t *) &cccd,
+                                            ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to %s RX: %d", paused ? "pause" : "resume", err);
+    return;
+  }
+  ESP_LOGD(TAG, "RX %s", paused ? "paused" : "resumed");
+  this->rx_paused_ = paused;
+}
+
+void BLENUSClientComponent::track_tx_level_() {
+  const size_t level = this->tx_buffer_->available();
+  this->stats_.track_tx_level(level);
+  switch (this->tx_watermark_.update(level)) {
+    case ble_nus_common::Watermark::ROSE_ABOVE_HIGH:
+      ESP_LOGW(TAG, "TX buffer above high watermark (%zu/%zu bytes)", level, this->tx_buffer_size_);
+      break;
+    case ble_nus_common::Watermark::FELL_BELOW_LOW:
+      ESP_LOGD(TAG, "TX buffer back below low watermark (%zu/%zu bytes)", level, this->tx_buffer_size_);
       break;
+    default:
+      break;
+  }
+}
+
+bool BLENUSClientComponent::tx_idle_() const {
+  return !this->tx_in_progress_ && (this->tx_buffer_ == nullptr || this->tx_buffer_->available() == 0);
+}
+
+void BLENUSClientComponent::check_flush_() {
+  if (!this->flush_pending_) {
+    return;
+  }
+  const bool done = this->tx_idle_();
+  if (!done) {
+    if (millis() - this->flush_started_ms_ <= this->tx_flush_timeout_ms_) {
+      return;
     }
-    //delay(5);
-    yield();
+    ESP_LOGW(TAG, "Flush timeout (%u ms) with %zu bytes pending", this->tx_flush_timeout_ms_,
+             this->tx_buffer_ != nullptr ? this->tx_buffer_->available() : 0);
   }
-  return uart::UARTFlushResult::UART_FLUSH_RESULT_SUCCESS;
+  this->flush_pending_ = false;
+  auto callbacks = std::move(this->flush_callbacks_);
+  this->flush_callbacks_.clear();
+  for (auto &callback : callbacks) {
+    callback(done);
+  }
+  this->on_flush_complete_.trigger(done);
 }
 
 void BLENUSClientComponent::set_state_(FsmState state) {
@@ -222,41 +826,140 @@ void BLENUSClientComponent::set_state_(FsmState state) {
     this->state_ = state;
   }
   this->state_enter_ms_ = millis();
+  if (state == FsmState::IDLE && this->slot_held_) {
+    this->slot_held_ = false;
+    this->scheduler_->release(this);
+  }
+}
+
+void BLENUSClientComponent::on_slot_granted() {
+  this->slot_held_ = true;
+  this->connect();
+}
+
+void BLENUSClientComponent::on_slot_revoked() {
+  if (this->state_ == FsmState::IDLE) {
+    this->set_state_(FsmState::IDLE);  // releases the slot
+    return;
+  }
+  this->disconnect();
+}
+
+bool BLENUSClientComponent::is_link_drained() const {
+  return this->state_ == FsmState::UART_LINK_ESTABLISHED && this->tx_idle_() &&
+         (this->rx_buffer_ == nullptr || this->rx_buffer_->empty()) && this->requests_.empty() &&
+         this->compression_state_ != CompressionState::NEGOTIATING;
 }
 
 void BLENUSClientComponent::send_next_chunk_in_ble_() {
-  if (this->state_ != FsmState::UART_LINK_ESTABLISHED || this->tx_buffer_ == nullptr ||
+  if (this->state_ != FsmState::UART_LINK_ESTABLISHED || this->tx_buffer_ == nullptr || this->tx_chunk_ == nullptr ||
       this->chr_commands_handle_ == 0) {
     this->tx_in_progress_ = false;
+    this->tx_in_flight_ = 0;
     ESP_LOGV(TAG, "send_next_chunk_in_ble_ , safeguard finish");
     return;
   }
 
-  size_t pending = this->tx_buffer_->available();
-  if (pending == 0) {
-    this->tx_in_progress_ = false;
-    ESP_LOGV(TAG, "send_next_chunk_in_ble_ , no more data to send");
+  if (this->compression_state_ == CompressionState::NEGOTIATING) {
+    // the wire format depends on the outcome of the negotiation, hold data until it is known
+    if (this->tx_in_flight_ == 0) {
+      this->tx_in_progress_ = false;
+    }
     return;
   }
 
-  this->last_activity_ms_ = millis();
+  const bool no_rsp = this->write_mode_ == WriteMode::WITHOUT_RESPONSE;
+  const esp_gatt_write_type_t write_type = no_rsp ? ESP_GATT_WRITE_TYPE_NO_RSP : ESP_GATT_WRITE_TYPE_RSP;
+  const uint8_t window = no_rsp ? this->tx_credits_ : 1;
 
-  size_t max_payload = this->mtu_ > 3 ? (this->mtu_ - 3) : 20;
-  std::vector<uint8_t> chunk(std::min(pending, max_payload));
-  size_t pulled = this->tx_buffer_->read(chunk.data(), chunk.size(), 0);
-  if (pulled == 0) {
-    this->tx_in_progress_ = false;
+  // RSP mode keeps a single chunk in flight; NO_RSP mode fills the credit window unless the stack is congested
+  while (this->tx_in_flight_ < window && !this->tx_congested_) {
+    size_t pending = this->tx_buffer_->available();
+    if (pending == 0) {
+      if (this->tx_in_flight_ == 0) {
+        this->tx_in_progress_ = false;
+        ESP_LOGV(TAG, "send_next_chunk_in_ble_ , no more data to send");
+      }
+      return;
+    }
+
+    this->last_activity_ms_ = millis();
+
+    size_t max_payload = std::min<size_t>(this->mtu_ > 3 ? (this->mtu_ - 3) : 20, MAX_CHUNK_PAYLOAD);
+    // the payload points into the ring or into tx_chunk_; the stack copies the value before
+    // esp_ble_gattc_write_char() returns, so both are reusable right after
+    const bool compressed = this->compression_state_ == CompressionState::ACTIVE;
+    const ble_nus_common::TxChunk next =
+        ble_nus_common::next_tx_chunk(*this->tx_buffer_, 0, max_payload, this->tx_chunk_.get(),
+                                      compressed ? &this->tx_encoder_ : nullptr, this->tx_raw_.get());
+    const uint8_t *chunk = next.data;
+    const size_t pulled = next.len;
+    const size_t consumed = next.consumed;
+    if (compressed) {
+      this->stats_.on_compressed(consumed, pulled);
+    }
+
+    esp_err_t err = esp_ble_gattc_write_char(this->parent_->get_gattc_if(), this->parent_->get_conn_id(),
+                                             this->chr_commands_handle_, pulled, const_cast<uint8_t *>(chunk),
+                                             write_type, ESP_GATT_AUTH_REQ_NONE);
+    ESP_LOGVV(TAG, "TX: %s", format_hex_pretty(chunk, pulled).c_str());
+    this->tx_buffer_->consume(consumed);
+    this->track_tx_level_();
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "Failed to write TX characteristic: %d", err);
+      this->stats_.on_write_failure();
+      this->stats_.on_dropped(consumed);
+      if (this->tx_in_flight_ == 0) {
+        this->tx_in_progress_ = false;
+      }
+      if (this->compression_state_ == CompressionState::ACTIVE) {
+        ESP_LOGW(TAG, "Lost a compressed chunk, reconnecting to resynchronise");
+        this->disconnect();
+      }
+      return;
+    }
+    this->stats_.on_tx_chunk(pulled);
+    this->tx_in_flight_++;
+  }
+}
+
+void BLENUSClientComponent::note_consumer_access_() {
+  // every UART entry point passes through here
+  this->enable_loop();
+  if (!this->keep_warm_enabled_) {
+    return;
+  }
+  const uint32_t now = millis();
+  const bool burst_start = this->last_access_ms_ == 0 || now - this->last_access_ms_ > KEEP_WARM_BURST_GAP_MS;
+  this->last_access_ms_ = now;
+  if (!burst_start) {
     return;
   }
+  if (this->keep_warm_configured_interval_ms_ == 0 && this->last_burst_ms_ != 0) {
+    // learn the cadence as a moving average of burst-to-burst spacing
+    const uint32_t spacing = now - this->last_burst_ms_;
+    this->keep_warm_interval_ms_ =
+        this->keep_warm_interval_ms_ == 0 ? spacing : (3 * this->keep_warm_interval_ms_ + spacing) / 4;
+    ESP_LOGV(TAG, "Keep-warm: poll spacing %u ms, learned cadence %u ms", spacing, this->keep_warm_interval_ms_);
+  }
+  this->last_burst_ms_ = now;
+  this->keep_warm_fired_ = false;
+}
 
-  esp_err_t err =
-      esp_ble_gattc_write_char(this->parent_->get_gattc_if(), this->parent_->get_conn_id(), this->chr_commands_handle_,
-                               pulled, chunk.data(), ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
-  ESP_LOGVV(TAG, "TX: %s", format_hex_pretty(chunk.data(), pulled).c_str());
-  if (err != ESP_OK) {
-    ESP_LOGW(TAG, "Failed to write TX characteristic: %d", err);
-    this->tx_in_progress_ = false;
+void BLENUSClientComponent::maybe_keep_warm_() {
+  if (!this->keep_warm_enabled_ || this->keep_warm_fired_ || this->keep_warm_interval_ms_ == 0 ||
+      this->last_burst_ms_ == 0) {
+    return;
   }
+  const uint32_t lead = std::min(this->keep_warm_lead_ms_, this->keep_warm_interval_ms_);
+  const uint32_t wake_at = this->last_burst_ms_ + this->keep_warm_interval_ms_ - lead;
+  if (static_cast<int32_t>(millis() - wake_at) < 0) {
+    return;
+  }
+  // one pre-connect per expected poll; idle_timeout drops the link again if the poll does not come
+  this->keep_warm_fired_ = true;
+  ESP_LOGD(TAG, "Keep-warm: connecting ahead of the next expected poll");
+  this->connect();
 }
 
 bool BLENUSClientComponent::maybe_autoconnect_() {
@@ -277,13 +980,90 @@ bool BLENUSClientComponent::maybe_autoconnect_() {
   return true;
 }
 
-void BLENUSClientComponent::defer_in_ble_(const std::function<void()> &fn) {
-  this->ble_defer_fn_ = fn;
-  if (this->parent_ != nullptr) {
-    esp_ble_gap_read_rssi(this->parent_->get_remote_bda());
+void BLENUSClientComponent::post_ble_work_(uint32_t work) {
+  this->ble_work_pending_.fetch_or(work, std::memory_order_release);
+  this->enable_loop_soon_any_context();
+}
+
+void BLENUSClientComponent::drain_ble_work_() {
+  // GATTC/GAP callbacks are dispatched from the main loop, so this is the same context as the BLE handlers
+  uint32_t work = this->ble_work_pending_.exchange(0, std::memory_order_acquire);
+  if (work == 0) {
+    return;
+  }
+  if (work & BLE_WORK_SEND_CHUNK) {
+    this->send_next_chunk_in_ble_();
   }
 }
 
+void BLENUSClientComponent::negotiate_link_layer_() {
+  // both requests are best effort: a peer that refuses simply keeps the link at 1M PHY / 27-octet PDUs
+  if (this->desired_data_length_ > 0) {
+    esp_err_t err = esp_ble_gap_set_pkt_data_len(this->parent_->get_remote_bda(), this->desired_data_length_);
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "Data length request failed: %d", err);
+    } else {
+      this->data_length_pending_ = true;
+    }
+  }
+#ifdef CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+  if (this->prefer_2m_phy_) {
+    const esp_ble_gap_phy_mask_t mask = ESP_BLE_GAP_PHY_1M_PREF_MASK | ESP_BLE_GAP_PHY_2M_PREF_MASK;
+    esp_err_t err = esp_ble_gap_set_preferred_phy(this->parent_->get_remote_bda(), 0, mask, mask,
+                                                  ESP_BLE_GAP_PHY_OPTIONS_NO_PREF);
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "PHY update request failed: %d", err);
+    }
+  }
+#endif
+}
+
+void BLENUSClientComponent::update_conn_profile_() {
+  if (!this->conn_profiles_enabled_ || this->state_ != FsmState::UART_LINK_ESTABLISHED) {
+    return;
+  }
+  if (this->conn_profile_pending_) {
+    // unanswered or rejected requests are retried after a pause, never back-to-back
+    if (millis() - this->conn_profile_request_ms_ < CONN_PROFILE_RETRY_MS) {
+      return;
+    }
+    this->conn_profile_pending_ = false;
+  }
+  const bool busy =
+      this->data_queued_() || millis() - this->last_activity_ms_ < this->conn_profile_idle_delay_ms_;
+  const ConnProfile wanted = busy ? ConnProfile::BULK : ConnProfile::IDLE;
+  if (wanted != this->conn_profile_) {
+    this->request_conn_profile_(wanted);
+  }
+}
+
+bool BLENUSClientComponent::data_queued_() const {
+  // TX is queued or in flight, or RX is waiting for the consumer; paused RX does not count, the slow consumer
+  // is better served by a slow link
+  return this->tx_in_progress_ || (this->tx_buffer_ != nullptr && !this->tx_buffer_->empty()) ||
+         (!this->rx_paused_ && this->rx_buffer_ != nullptr && !this->rx_buffer_->empty());
+}
+
+void BLENUSClientComponent::request_conn_profile_(ConnProfile profile) {
+  const ConnParams &params = profile == ConnProfile::BULK ? this->bulk_conn_params_ : this->idle_conn_params_;
+  esp_ble_conn_update_params_t update{};
+  memcpy(update.bda, this->parent_->get_remote_bda(), sizeof(esp_bd_addr_t));
+  update.min_int = params.min_interval;
+  update.max_int = params.max_interval;
+  update.latency = params.latency;
+  update.timeout = params.timeout;
+  // a refused request also waits out the retry pause, so a failing stack is not asked again on every loop
+  this->conn_profile_pending_ = true;
+  this->conn_profile_request_ms_ = millis();
+  esp_err_t err = esp_ble_gap_update_conn_params(&update);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Connection parameter update request failed: %d", err);
+    return;
+  }
+  ESP_LOGD(TAG, "Requesting %s connection profile", profile == ConnProfile::BULK ? "bulk" : "idle");
+  this->conn_profile_ = profile;
+}
+
 void BLENUSClientComponent::watchdog_() {
   switch (this->state_) {
     case FsmState::CONNECTING:
@@ -314,7 +1094,7 @@ void BLENUSClientComponent::handle_state_() {
 
   switch (this->state_) {
     case FsmState::IDLE:
-      // TODO: trigger connect when configured
+      this->maybe_keep_warm_();
       break;
     case FsmState::CONNECTING:
       // Wait for GATTC events
@@ -325,11 +1105,17 @@ void BLENUSClientComponent::handle_state_() {
     case FsmState::ENABLING_NOTIF:
       if (this->auth_completed_ && this->discovered_chars_ && this->notifications_enabled_) {
         this->set_state_(FsmState::UART_LINK_ESTABLISHED);
+        this->stats_.on_link_up();
+        this->start_compression_();
+        ESP_LOGD(TAG, "UART link up %u ms after connect()%s", millis() - this->connect_started_ms_,
+                 this->resuming_bond_ ? " (bonded resume)" : "");
         this->on_connected_.trigger();
         this->last_activity_ms_ = millis();
       }
       break;
     case FsmState::UART_LINK_ESTABLISHED:
+      this->check_compression_();
+      this->update_conn_profile_();
       if (this->idle_disconnect_timeout_ms_ > 0 &&
           millis() - this->last_activity_ms_ > this->idle_disconnect_timeout_ms_) {
         ESP_LOGI(TAG, "Idle timeout reached, disconnecting BLE");
@@ -345,6 +1131,56 @@ void BLENUSClientComponent::handle_state_() {
   }
 }
 
+#ifdef USE_SENSOR
+void BLENUSClientComponent::publish_stats_() {
+  const uint32_t now = millis();
+  const float tx_rate = this->tx_rate_.sample(this->stats_.bytes_sent(), now);
+  const float rx_rate = this->rx_rate_.sample(this->stats_.bytes_received(), now);
+  if (this->bytes_sent_sensor_ != nullptr)
+    this->bytes_sent_sensor_->publish_state(this->stats_.bytes_sent());
+  if (this->bytes_received_sensor_ != nullptr)
+    this->bytes_received_sensor_->publish_state(this->stats_.bytes_received());
+  if (this->chunks_sent_sensor_ != nullptr)
+    this->chunks_sent_sensor_->publish_state(this->stats_.chunks_sent());
+  if (this->chunks_received_sensor_ != nullptr)
+    this->chunks_received_sensor_->publish_state(this->stats_.chunks_received());
+  if (this->dropped_bytes_sensor_ != nullptr)
+    this->dropped_bytes_sensor_->publish_state(this->stats_.dropped_bytes());
+  if (this->write_failures_sensor_ != nullptr)
+    this->write_failures_sensor_->publish_state(this->stats_.write_failures());
+  if (this->reconnects_sensor_ != nullptr)
+    this->reconnects_sensor_->publish_state(this->stats_.reconnects());
+  if (this->frame_errors_sensor_ != nullptr)
+    this->frame_errors_sensor_->publish_state(this->stats_.frame_errors());
+  if (this->compression_ratio_sensor_ != nullptr) {
+    const float ratio = this->stats_.compression_ratio();
+    this->compression_ratio_sensor_->publish_state(ratio > 0.0f ? ratio : NAN);
+  }
+  if (this->rx_high_water_sensor_ != nullptr)
+    this->rx_high_water_sensor_->publish_state(this->stats_.rx_high_water());
+  if (this->tx_high_water_sensor_ != nullptr)
+    this->tx_high_water_sensor_->publish_state(this->stats_.tx_high_water());
+  if (this->tx_throughput_sensor_ != nullptr)
+    this->tx_throughput_sensor_->publish_state(tx_rate);
+  if (this->rx_throughput_sensor_ != nullptr)
+    this->rx_throughput_sensor_->publish_state(rx_rate);
+
+  const bool linked = this->state_ == FsmState::UART_LINK_ESTABLISHED;
+  if (this->mtu_sensor_ != nullptr)
+    this->mtu_sensor_->publish_state(linked ? this->mtu_ : NAN);
+  if (this->data_length_sensor_ != nullptr)
+    this->data_length_sensor_->publish_state(linked ? this->ll_tx_octets_ : NAN);
+  if (this->phy_sensor_ != nullptr)
+    this->phy_sensor_->publish_state(linked ? this->tx_phy_ : NAN);
+  if (this->rssi_sensor_ != nullptr) {
+    this->rssi_sensor_->publish_state(linked ? this->rssi_ : NAN);
+    // refresh for the next publish; the GAP handler stores the result
+    if (linked)
+      esp_ble_gap_read_rssi(this->parent_->get_remote_bda());
+  }
+}
+#endif
+
 bool BLENUSClientComponent::discover_characteristics_() {
   auto chr_commands = this->parent_->get_characteristic(this->service_uuid_, this->rx_uuid_for_commands_);
   auto chr_responses = this->parent_->get_characteristic(this->service_uuid_, this->tx_uuid_for_responses_);
@@ -367,10 +1203,100 @@ bool BLENUSClientComponent::discover_characteristics_() {
   }
   this->chr_cccd_handle_ = desc->handle;
 
+  // optional: only peers that offer compression have it
+  this->chr_compression_handle_ = 0;
+  if (this->compression_) {
+    auto chr_compression = this->parent_->get_characteristic(
+        this->service_uuid_, espbt::ESPBTUUID::from_raw(ble_nus_common::LZ_CHAR_UUID));
+    if (chr_compression != nullptr) {
+      this->chr_compression_handle_ = chr_compression->handle;
+    }
+  }
+
+  const bool can_notify = (chr_responses->properties & ESP_GATT_CHAR_PROP_BIT_NOTIFY) != 0;
+  const bool can_indicate = (chr_responses->properties & ESP_GATT_CHAR_PROP_BIT_INDICATE) != 0;
+  switch (this->rx_mode_) {
+    case RxMode::NOTIFY:
+      this->rx_indicate_ = false;
+      break;
+    case RxMode::INDICATE:
+      this->rx_indicate_ = true;
+      break;
+    case RxMode::AUTO:
+    default:
+      // notifications are faster; indications only when they are all the peer offers
+      this->rx_indicate_ = !can_notify && can_indicate;
+      break;
+  }
+  if (this->rx_indicate_ ? !can_indicate : !can_notify) {
+    ESP_LOGW(TAG, "TX characteristic does not advertise %s, subscribing anyway",
+             this->rx_indicate_ ? "indications" : "notifications");
+  }
+
   this->discovered_chars_ = true;
   return true;
 }
 
+bool BLENUSClientComponent::subscribe_notifications_() {
+  // register for notify on TX characteristic (NUS TX -> notifications)
+  if (this->chr_responses_handle_ != 0) {
+    auto status = esp_ble_gattc_register_for_notify(this->parent_->get_gattc_if(), this->parent_->get_remote_bda(),
+                                                    this->chr_responses_handle_);
+    if (status != ESP_OK) {
+      ESP_LOGW(TAG, "Register for notify failed: %d", status);
+    }
+  }
+
+  uint16_t notify_en = this->rx_indicate_ ? 0x0002 : 0x0001;
+  auto err = esp_ble_gattc_write_char_descr(this->parent_->get_gattc_if(), this->parent_->get_conn_id(),
+                                            this->chr_cccd_handle_, sizeof(notify_en), (uint8_t *) &notify_en,
+                                            ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to enable notifications on handle 0x%04X: %d", this->chr_cccd_handle_, err);
+    return false;
+  }
+  return true;
+}
+
+bool BLENUSClientComponent::load_cached_handles_() {
+  if (!this->cache_handles_ || this->handle_cache_.peer != this->parent_->get_address() ||
+      this->handle_cache_.commands == 0 || this->handle_cache_.responses == 0 || this->handle_cache_.cccd == 0) {
+    return false;
+  }
+  this->chr_commands_handle_ = this->handle_cache_.commands;
+  this->chr_responses_handle_ = this->handle_cache_.responses;
+  this->chr_cccd_handle_ = this->handle_cache_.cccd;
+  this->rx_indicate_ = this->handle_cache_.indicate != 0;
+  this->chr_compression_handle_ = this->handle_cache_.compression;
+  this->discovered_chars_ = true;
+  this->handles_from_cache_ = true;
+  return true;
+}
+
+void BLENUSClientComponent::store_cached_handles_() {
+  if (!this->cache_handles_) {
+    return;
+  }
+  HandleCache fresh{this->parent_->get_address(), this->chr_commands_handle_, this->chr_responses_handle_,
+                    this->chr_cccd_handle_, this->rx_indicate_, this->chr_compression_handle_};
+  if (memcmp(&fresh, &this->handle_cache_, sizeof(HandleCache)) == 0) {
+    return;
+  }
+  this->handle_cache_ = fresh;
+  this->handle_cache_pref_.save(&this->handle_cache_);
+  ESP_LOGD(TAG, "GATT handles cached (RX 0x%04X, TX 0x%04X, CCCD 0x%04X)", fresh.commands, fresh.responses,
+           fresh.cccd);
+}
+
+void BLENUSClientComponent::invalidate_cached_handles_() {
+  if (!this->cache_handles_ || this->handle_cache_.peer == 0) {
+    return;
+  }
+  ESP_LOGI(TAG, "Dropping cached GATT handles, next connection runs full discovery");
+  this->handle_cache_ = {};
+  this->handle_cache_pref_.save(&this->handle_cache_);
+}
+
 void BLENUSClientComponent::gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
                                                 esp_ble_gattc_cb_param_t *param) {
   
@@ -378,6 +1304,8 @@ void BLENUSClientComponent::gattc_event_handler(esp_gattc_cb_event_t event, esp_
     ESP_LOGV(TAG, "gattc_event_handler called but no parent");
     return;
   }
+  ble_nus_common::BleDispatchScope dispatch;
+  this->enable_loop();
 
   ESP_LOGV(TAG, "GATTC event: %d", event);
   
@@ -393,6 +1321,8 @@ void BLENUSClientComponent::gattc_event_handler(esp_gattc_cb_event_t event, esp_
     case ESP_GATTC_OPEN_EVT: {
       if (param->open.status == ESP_GATT_OK) {
         esp_ble_gattc_send_mtu_req(this->parent_->get_gattc_if(), this->parent_->get_conn_id());
+        this->start_encryption_();
+        this->negotiate_link_layer_();
       } else {
         ESP_LOGW(TAG, "GATTC open failed: %d", param->open.status);
         this->set_state_(FsmState::ERROR);
@@ -405,6 +1335,17 @@ void BLENUSClientComponent::gattc_event_handler(esp_gattc_cb_event_t event, esp_
       } else {
         ESP_LOGW(TAG, "MTU config failed: %d", param->cfg_mtu.status);
       }
+      // fast path: subscribe with cached handles now, SEARCH_CMPL only confirms them later
+      if (this->state_ == FsmState::CONNECTING && !this->services_discovered_ && this->load_cached_handles_()) {
+        ESP_LOGD(TAG, "Using cached GATT handles, skipping wait for discovery");
+        if (this->subscribe_notifications_()) {
+          this->set_state_(FsmState::ENABLING_NOTIF);
+        } else {
+          this->invalidate_cached_handles_();
+          this->handles_from_cache_ = false;
+          this->discovered_chars_ = false;
+        }
+      }
     } break;
     case ESP_GATTC_SEARCH_CMPL_EVT: {
       if (param->search_cmpl.conn_id != this->parent_->get_conn_id())
@@ -415,35 +1356,37 @@ void BLENUSClientComponent::gattc_event_handler(esp_gattc_cb_event_t event, esp_
         break;
       }
 
-      if (this->notifications_enabled_) {
-        ESP_LOGV(TAG, "Notifications already enabled, skipping re-subscription");
-        break;
-      }
-
+      const HandleCache cached{0, this->chr_commands_handle_, this->chr_responses_handle_, this->chr_cccd_handle_,
+                               this->rx_indicate_, this->chr_compression_handle_};
       if (!this->discover_characteristics_()) {
+        if (this->handles_from_cache_) {
+          this->invalidate_cached_handles_();
+        }
         this->set_state_(FsmState::ERROR);
         this->parent_->disconnect();
         break;
       }
 
-      // register for notify on TX characteristic (NUS TX -> notifications)
-      if (this->chr_responses_handle_ != 0) {
-        auto status = esp_ble_gattc_register_for_notify(this->parent_->get_gattc_if(), this->parent_->get_remote_bda(),
-                                                        this->chr_responses_handle_);
-        if (status != ESP_OK) {
-          ESP_LOGW(TAG, "Register for notify failed: %d", status);
+      this->services_discovered_ = true;
+
+      if (this->handles_from_cache_) {
+        if (cached.commands == this->chr_commands_handle_ && cached.responses == this->chr_responses_handle_ &&
+            cached.cccd == this->chr_cccd_handle_ && (cached.indicate != 0) == this->rx_indicate_ &&
+            cached.compression == this->chr_compression_handle_) {
+          ESP_LOGV(TAG, "Discovery confirmed cached GATT handles");
+          break;
         }
+        ESP_LOGW(TAG, "Cached GATT handles are stale, re-subscribing");
+        this->handles_from_cache_ = false;
+        this->notifications_enabled_ = false;
+      } else if (this->notifications_enabled_) {
+        ESP_LOGV(TAG, "Notifications already enabled, skipping re-subscription");
+        break;
       }
 
-      this->services_discovered_ = true;
+      this->store_cached_handles_();
 
-      uint16_t notify_en = 0x0001;
-      auto err = esp_ble_gattc_write_char_descr(this->parent_->get_gattc_if(), this->parent_->get_conn_id(),
-                                                this->chr_cccd_handle_, sizeof(notify_en), (uint8_t *) &notify_en,
-                                                ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
-
-      if (err != ESP_OK) {
-        ESP_LOGW(TAG, "Failed to enable notifications on handle 0x%04X: %d", this->chr_cccd_handle_, err);
+      if (!this->subscribe_notifications_()) {
         this->set_state_(FsmState::ERROR);
         return;
       }
@@ -454,30 +1397,57 @@ void BLENUSClientComponent::gattc_event_handler(esp_gattc_cb_event_t event, esp_
     case ESP_GATTC_WRITE_DESCR_EVT: {
       if (param->write.conn_id != this->parent_->get_conn_id())
         break;
+      if (this->state_ == FsmState::UART_LINK_ESTABLISHED && param->write.handle == this->chr_cccd_handle_) {
+        // flow control toggle on a live link, not part of the bring-up
+        if (param->write.status != ESP_GATT_OK) {
+          ESP_LOGW(TAG, "RX flow control CCCD write failed: status=%d", param->write.status);
+        }
+        break;
+      }
       if (param->write.status == ESP_GATT_OK) {
         if (param->write.handle == this->chr_cccd_handle_) {
           this->notifications_enabled_ = true;
-          ESP_LOGI(TAG, "Notifications enabled (CCCD write ok)");
+          ESP_LOGI(TAG, "%s enabled (CCCD write ok)", this->rx_indicate_ ? "Indications" : "Notifications");
         } else {
           ESP_LOGD(TAG, "ESP_GATTC_WRITE_DESCR_EVT not for CCCD.. (handle = %u)", param->write.handle);
         }
       } else {
         ESP_LOGW(TAG, "CCCD write failed: status=%d", param->write.status);
+        if (this->handles_from_cache_) {
+          this->invalidate_cached_handles_();
+        }
         this->set_state_(FsmState::ERROR);
       }
     } break;
 
+    case ESP_GATTC_READ_CHAR_EVT: {
+      if (param->read.conn_id != this->parent_->get_conn_id())
+        break;
+      if (param->read.handle != 0 && param->read.handle == this->chr_compression_handle_) {
+        this->on_compression_read_(param->read.status, param->read.value, param->read.value_len);
+      }
+    } break;
+
     case ESP_GATTC_WRITE_CHAR_EVT: {
       if (param->write.conn_id != this->parent_->get_conn_id())
         break;
+      if (param->write.handle != 0 && param->write.handle == this->chr_compression_handle_) {
+        // negotiation, not part of the data stream
+        this->on_compression_write_(param->write.status);
+        break;
+      }
+      if (this->tx_in_flight_ > 0) {
+        this->tx_in_flight_--;
+      }
       if (param->write.status == ESP_GATT_OK) {
         size_t pending = this->tx_buffer_->available();
-        if (pending == 0) {
+        if (pending == 0 && this->tx_in_flight_ == 0) {
           this->tx_in_progress_ = false;
           ESP_LOGV(TAG, "TX completed: no more data to send");
           this->on_sent_.trigger();
+          this->check_flush_();
           return;
-        } else {
+        } else if (pending > 0) {
           this->last_activity_ms_ = millis();
           // we are already in BLE thread, no need to defer next portion
           this->send_next_chunk_in_ble_();
@@ -485,7 +1455,26 @@ void BLENUSClientComponent::gattc_event_handler(esp_gattc_cb_event_t event, esp_
         }
       } else {
         ESP_LOGW(TAG, "TX write failed: status=%d", param->write.status);
-        this->tx_in_progress_ = false;
+        this->stats_.on_write_failure();
+        if (param->write.status == ESP_GATT_INVALID_HANDLE && this->handles_from_cache_) {
+          this->invalidate_cached_handles_();
+        }
+        if (this->tx_in_flight_ == 0) {
+          this->tx_in_progress_ = false;
+        }
+        if (this->compression_state_ == CompressionState::ACTIVE) {
+          ESP_LOGW(TAG, "Peer rejected a compressed chunk, reconnecting to resynchronise");
+          this->disconnect();
+        }
+      }
+    } break;
+    case ESP_GATTC_CONGEST_EVT: {
+      if (param->congest.conn_id != this->parent_->get_conn_id())
+        break;
+      ESP_LOGV(TAG, "Link %s", param->congest.congested ? "congested" : "uncongested");
+      this->tx_congested_ = param->congest.congested;
+      if (!this->tx_congested_ && this->tx_in_progress_) {
+        this->send_next_chunk_in_ble_();
       }
     } break;
     case ESP_GATTC_NOTIFY_EVT: {
@@ -494,9 +1483,8 @@ void BLENUSClientComponent::gattc_event_handler(esp_gattc_cb_event_t event, esp_
       if (param->notify.conn_id != this->parent_->get_conn_id())
         break;
 
-      if (!param->notify.is_notify) {
-        ESP_LOGW(TAG, "Indication received instead of notification, not supported");
-        break;
+      if (!param->notify.is_notify && !this->rx_indicate_) {
+        ESP_LOGV(TAG, "Indication received while subscribed for notifications");
       }
 
       if (!param->notify.value || param->notify.value_len == 0) {
@@ -506,18 +1494,51 @@ void BLENUSClientComponent::gattc_event_handler(esp_gattc_cb_event_t event, esp_
 
       ESP_LOGVV(TAG, "RX: %s", format_hex_pretty(param->notify.value, param->notify.value_len).c_str());
 
+      this->stats_.on_rx_chunk(param->notify.value_len);
       if (this->rx_buffer_ != nullptr) {
-        size_t written = this->rx_buffer_->write(param->notify.value, param->notify.value_len);
-        if (written < param->notify.value_len) {
-          ESP_LOGW(TAG, "RX buffer overflow, dropped %d bytes", param->notify.value_len - (int) written);
-        }
+        this->store_rx_chunk_(param->notify.value, param->notify.value_len);
+        this->track_rx_level_();
         this->last_activity_ms_ = millis();
         this->on_data_.trigger();
+        if (this->requests_.sent() > 0) {
+          // the stream belongs to the outstanding requests
+          this->match_requests_();
+        } else {
+          if (this->frame_dispatch_) {
+            this->dispatch_frames_();
+          }
+          if (this->message_dispatch_) {
+            this->rx_messages_.on_rx(millis());
+            this->dispatch_messages_();
+          }
+        }
+      }
+    } break;
+    case ESP_GATTC_SRVC_CHG_EVT: {
+      if (!this->parent_->check_addr(param->srvc_chg.remote_bda))
+        break;
+      ESP_LOGI(TAG, "Service Changed indication received");
+      this->invalidate_cached_handles_();
+      // handles in use may no longer be valid; reconnect with full discovery
+      if (this->state_ != FsmState::IDLE && this->state_ != FsmState::DISCONNECTING) {
+        this->disconnect();
       }
     } break;
     case ESP_GATTC_DISCONNECT_EVT: {
       ESP_LOGI(TAG, "GATTC disconnected, reason=0x%02X", param->disconnect.reason);
+      this->tx_in_progress_ = false;
+      this->tx_in_flight_ = 0;
+      this->tx_congested_ = false;
+      this->rx_paused_ = false;
+      this->compression_state_ = CompressionState::OFF;
+      this->conn_profile_ = ConnProfile::NONE;
+      this->conn_profile_pending_ = false;
+      this->conn_interval_ = 0;
+      this->data_length_pending_ = false;
+      this->ll_tx_octets_ = this->ll_rx_octets_ = 27;
+      this->tx_phy_ = this->rx_phy_ = 1;
       this->set_state_(FsmState::IDLE);
+      this->fail_requests_(this->requests_.pop_sent(millis()), RequestResult::DISCONNECTED);
       this->on_disconnected_.trigger();
     } break;
     default:
@@ -526,6 +1547,11 @@ void BLENUSClientComponent::gattc_event_handler(esp_gattc_cb_event_t event, esp_
 }
 
 void BLENUSClientComponent::gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+  ble_nus_common::BleDispatchScope dispatch;
+  // GAP events only matter with a link in progress; scanning traffic must not keep the loop awake
+  if (this->state_ != FsmState::IDLE) {
+    this->enable_loop();
+  }
   switch (event) {
     case ESP_GAP_BLE_PASSKEY_REQ_EVT: {
       if (!this->parent_->check_addr(param->ble_security.ble_req.bd_addr)) {
@@ -551,23 +1577,72 @@ void BLENUSClientComponent::gap_event_handler(esp_gap_ble_cb_event_t event, esp_
         break;
       }
       if (param->ble_security.auth_cmpl.success) {
-        ESP_LOGI(TAG, "Pairing completed (auth mode %d)", param->ble_security.auth_cmpl.auth_mode);
+        ESP_LOGI(TAG, "%s completed (auth mode %d)", this->resuming_bond_ ? "Encryption" : "Pairing",
+                 param->ble_security.auth_cmpl.auth_mode);
         this->auth_completed_ = true;
       } else {
-        ESP_LOGW(TAG, "Pairing failed, reason=%d", param->ble_security.auth_cmpl.fail_reason);
+        ESP_LOGW(TAG, "%s failed, reason=%d", this->resuming_bond_ ? "Bonded resume" : "Pairing",
+                 param->ble_security.auth_cmpl.fail_reason);
+        if (this->resuming_bond_) {
+          // the peer lost its keys: forget ours so the next attempt pairs from scratch
+          esp_ble_remove_bond_device(param->ble_security.auth_cmpl.bd_addr);
+          this->resuming_bond_ = false;
+        }
       }
       break;
     }
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT: {
+      if (!this->parent_->check_addr(param->update_conn_params.bda)) {
+        break;
+      }
+      if (param->update_conn_params.status != ESP_BT_STATUS_SUCCESS) {
+        ESP_LOGW(TAG, "Connection parameter update rejected: %d", param->update_conn_params.status);
+        // stays pending, so update_conn_profile_() retries after CONN_PROFILE_RETRY_MS
+        this->conn_profile_ = ConnProfile::NONE;
+        break;
+      }
+      this->conn_profile_pending_ = false;
+      this->conn_interval_ = param->update_conn_params.conn_int;
+      ESP_LOGD(TAG, "Connection parameters: interval %.2f ms, latency %u, timeout %u ms",
+               this->conn_interval_ * 1.25f, param->update_conn_params.latency,
+               param->update_conn_params.timeout * 10);
+      break;
+    }
+    case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT: {
+      // the event carries no peer address; only consume it while our own request is outstanding
+      if (!this->data_length_pending_) {
+        break;
+      }
+      this->data_length_pending_ = false;
+      if (param->pkt_data_length_cmpl.status != ESP_BT_STATUS_SUCCESS) {
+        ESP_LOGW(TAG, "Data length extension refused: %d", param->pkt_data_length_cmpl.status);
+        break;
+      }
+      this->ll_tx_octets_ = param->pkt_data_length_cmpl.params.tx_len;
+      this->ll_rx_octets_ = param->pkt_data_length_cmpl.params.rx_len;
+      ESP_LOGD(TAG, "LL data length: TX %u / RX %u octets", this->ll_tx_octets_, this->ll_rx_octets_);
+      break;
+    }
+#ifdef CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT: {
+      if (!this->parent_->check_addr(param->phy_update.bda)) {
+        break;
+      }
+      if (param->phy_update.status != ESP_BT_STATUS_SUCCESS) {
+        ESP_LOGW(TAG, "PHY update refused: %d", param->phy_update.status);
+        break;
+      }
+      this->tx_phy_ = param->phy_update.tx_phy;
+      this->rx_phy_ = param->phy_update.rx_phy;
+      ESP_LOGD(TAG, "PHY: TX %s / RX %s", phy_to_str(this->tx_phy_), phy_to_str(this->rx_phy_));
+      break;
+    }
+#endif
     case ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT: {
       if (!this->parent_->check_addr(param->read_rssi_cmpl.remote_addr)) {
         break;
       }
       this->rssi_ = param->read_rssi_cmpl.rssi;
-      if (this->ble_defer_fn_ != nullptr) {
-        auto fn = this->ble_defer_fn_;
-        this->ble_defer_fn_ = nullptr;
-        fn();
-      }
       break;
     }
     default:
@@ -5,21 +5,39 @@
 #include "esphome/components/uart/uart_component.h"
 #include "esphome/components/esp32_ble_tracker/esp32_ble_tracker.h"
 #include "esphome/core/automation.h"
+#include "esphome/core/preferences.h"
 #include "esp_gatt_defs.h"
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <vector>
 #include <functional>
 
-#include "esphome/components/ring_buffer/ring_buffer.h"
+#include "esphome/components/ble_nus_common/byte_ring.h"
+#include "esphome/components/ble_nus_common/frame_codec.h"
+#include "esphome/components/ble_nus_common/link_scheduler.h"
+#include "esphome/components/ble_nus_common/lz_codec.h"
+#include "esphome/components/ble_nus_common/message_coalescer.h"
+#include "esphome/components/ble_nus_common/request_pipeline.h"
+#include "esphome/components/ble_nus_common/response_matcher.h"
+#include "esphome/components/ble_nus_common/rx_overflow.h"
+#include "esphome/components/ble_nus_common/watermark.h"
+#include "esphome/components/ble_nus_common/transport_stats.h"
+
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
 
 namespace esphome {
 namespace ble_nus_client {
 
 namespace espbt = esphome::esp32_ble_tracker;
 
-class BLENUSClientComponent : public uart::UARTComponent, public ble_client::BLEClientNode, public Component {
+class BLENUSClientComponent : public uart::UARTComponent,
+                              public ble_client::BLEClientNode,
+                              public Component,
+                              public ble_nus_common::ScheduledLink {
  public:
   enum class FsmState : uint8_t {
     IDLE,
@@ -31,6 +49,54 @@ class BLENUSClientComponent : public uart::UARTComponent, public ble_client::BLE
     ERROR,
   };
 
+  // Deferred work executed from the BLE event context. Each kind is a bit, so posting the same work twice
+  // coalesces into one run and nothing posted is ever overwritten.
+  enum BleWork : uint32_t {
+    BLE_WORK_SEND_CHUNK = 1U << 0,
+  };
+
+  // Connection-parameter profile requested from the peer; NONE until the first request on a link
+  enum class ConnProfile : uint8_t {
+    NONE,
+    BULK,
+    IDLE,
+  };
+
+  // In controller units: intervals 1.25 ms, supervision timeout 10 ms
+  struct ConnParams {
+    uint16_t min_interval;
+    uint16_t max_interval;
+    uint16_t latency;
+    uint16_t timeout;
+  };
+
+  enum class SecurityMode : uint8_t {
+    NONE,
+    JUST_WORKS,
+    PASSKEY,
+    PASSKEY_BOND,
+  };
+
+  enum class CompressionState : uint8_t {
+    OFF,
+    NEGOTIATING,
+    ACTIVE,
+  };
+
+  enum class RxMode : uint8_t {
+    NOTIFY,
+    INDICATE,
+    AUTO,
+  };
+
+  enum class WriteMode : uint8_t {
+    WITH_RESPONSE,
+    WITHOUT_RESPONSE,
+  };
+
+  using RequestResult = ble_nus_common::RequestResult;
+  using RequestCallback = ble_nus_common::RequestCallback;
+
   void setup() override;
   void loop() override;
   void dump_config() override;
@@ -48,6 +114,11 @@ class BLENUSClientComponent : public uart::UARTComponent, public ble_client::BLE
                            esp_ble_gattc_cb_param_t *param) override;
   void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) override;
 
+  // ble_nus_common::ScheduledLink interface
+  void on_slot_granted() override;
+  void on_slot_revoked() override;
+  bool is_link_drained() const override;
+
   // uart::UARTComponent interface
   void write_array(const uint8_t *data, size_t len) override;
   void write_byte(uint8_t data);
@@ -56,6 +127,24 @@ class BLENUSClientComponent : public uart::UARTComponent, public ble_client::BLE
   bool read_array(uint8_t *data, size_t len) override;
   size_t available() override;
   uart::UARTFlushResult flush() override;
+  /// Non-blocking flush: `callback(true)` fires once all queued TX data has been sent,
+  /// `callback(false)` if that did not happen within the flush timeout.
+  void flush_async(std::function<void(bool)> &&callback);
+
+  /// Queues `data` as one frame (see frame_codec.h). All-or-nothing: false if the frame does not fit.
+  bool write_frame(const uint8_t *data, size_t len);
+  /// Takes the next complete, CRC-checked frame out of the RX buffer. Needs `framing` enabled.
+  bool read_frame(std::vector<uint8_t> &frame);
+
+  /// Sends `data` once the link is up and a pipeline slot is free, and calls `callback` with the response that
+  /// `matcher` cuts from the RX stream. Responses are matched in request order. `timeout_ms` (0: none) runs while
+  /// the request is at the head of the queue. Returns false, without calling back, if `data` can never fit the
+  /// TX buffer.
+  bool send_request(std::vector<uint8_t> data, ble_nus_common::ResponseMatcher matcher, uint32_t timeout_ms,
+                    RequestCallback &&callback);
+  size_t get_pending_requests() const { return this->requests_.size(); }
+  /// Requests sent ahead of their predecessors' responses; 1 waits for each response before the next request.
+  void set_max_outstanding_requests(uint8_t count) { this->requests_.set_max_outstanding(count); }
 
   void check_logger_conflict() override {}
 
@@ -63,25 +152,140 @@ class BLENUSClientComponent : public uart::UARTComponent, public ble_client::BLE
   void set_rx_uuid(const char *uuid) { this->rx_uuid_for_commands_ = espbt::ESPBTUUID::from_raw(uuid); }
   void set_tx_uuid(const char *uuid) { this->tx_uuid_for_responses_ = espbt::ESPBTUUID::from_raw(uuid); }
   void set_passkey(uint32_t pin) { this->passkey_ = pin % 1000000U; }
+  void set_security_mode(SecurityMode mode) { this->security_mode_ = mode; }
   void set_mtu(uint16_t mtu) { this->desired_mtu_ = mtu; }
+  void set_write_mode(WriteMode mode) { this->write_mode_ = mode; }
+  void set_tx_credits(uint8_t credits) { this->tx_credits_ = credits > 0 ? credits : 1; }
   void set_flush_timeout(uint32_t timeout_ms) { this->tx_flush_timeout_ms_ = timeout_ms; }
+  void set_rx_buffer_size(size_t size) { this->rx_buffer_size_ = size; }
+  void set_tx_buffer_size(size_t size) { this->tx_buffer_size_ = size; }
+  void set_buffers_in_psram(bool enabled) { this->buffers_in_psram_ = enabled; }
+  void set_rx_mode(RxMode mode) { this->rx_mode_ = mode; }
+  void set_framing(size_t max_frame_size) {
+    this->framing_ = true;
+    this->max_frame_size_ = max_frame_size;
+  }
+  void set_frame_dispatch(bool enabled) { this->frame_dispatch_ = enabled; }
+  void set_message_dispatch(uint32_t idle_gap_ms, size_t max_size, uint32_t max_latency_ms,
+                            const std::vector<uint8_t> &delimiter) {
+    this->rx_messages_.configure(idle_gap_ms, max_size, max_latency_ms, delimiter.data(), delimiter.size());
+    this->message_dispatch_ = true;
+  }
+  void set_compression(bool enabled) { this->compression_ = enabled; }
+  void set_rx_overflow_policy(ble_nus_common::RxOverflowPolicy policy) { this->rx_overflow_policy_ = policy; }
+  void set_watermarks(uint8_t high_pct, uint8_t low_pct) {
+    this->high_watermark_pct_ = high_pct;
+    this->low_watermark_pct_ = low_pct;
+  }
+  void set_bulk_conn_params(uint16_t min_interval, uint16_t max_interval, uint16_t latency, uint16_t timeout) {
+    this->bulk_conn_params_ = {min_interval, max_interval, latency, timeout};
+    this->conn_profiles_enabled_ = true;
+  }
+  void set_idle_conn_params(uint16_t min_interval, uint16_t max_interval, uint16_t latency, uint16_t timeout) {
+    this->idle_conn_params_ = {min_interval, max_interval, latency, timeout};
+    this->conn_profiles_enabled_ = true;
+  }
+  void set_cache_handles(bool enabled) { this->cache_handles_ = enabled; }
+  void set_prefer_2m_phy(bool prefer) { this->prefer_2m_phy_ = prefer; }
+  void set_data_length(uint16_t octets) { this->desired_data_length_ = octets; }
+  void set_conn_profile_idle_delay(uint32_t delay_ms) { this->conn_profile_idle_delay_ms_ = delay_ms; }
   void set_idle_disconnect_timeout(uint32_t timeout_ms) { this->idle_disconnect_timeout_ms_ = timeout_ms; }
   void set_connect_on_demand(bool enabled) { this->connect_on_demand_ = enabled; }
+  /// Pre-connect ahead of the consumer's polls. `interval_ms == 0` learns the cadence from observed accesses.
+  void set_keep_warm(uint32_t interval_ms, uint32_t lead_ms) {
+    this->keep_warm_enabled_ = true;
+    this->keep_warm_configured_interval_ms_ = interval_ms;
+    this->keep_warm_interval_ms_ = interval_ms;
+    this->keep_warm_lead_ms_ = lead_ms;
+  }
+  /// Connections wait for a slot from `scheduler`; `session_timeout_ms == 0` uses the scheduler's default.
+  void set_scheduler(ble_nus_common::LinkScheduler *scheduler, uint32_t session_timeout_ms) {
+    this->scheduler_ = scheduler;
+    this->session_timeout_ms_ = session_timeout_ms;
+  }
   void set_autoconnect_on_access(bool enabled) { this->set_connect_on_demand(enabled); }  // backward compat
 
   Trigger<> *get_on_connected_trigger() { return &this->on_connected_; }
   Trigger<> *get_on_disconnected_trigger() { return &this->on_disconnected_; }
   Trigger<> *get_on_sent_trigger() { return &this->on_sent_; }
   Trigger<> *get_on_data_trigger() { return &this->on_data_; }
+  Trigger<bool> *get_on_flush_complete_trigger() { return &this->on_flush_complete_; }
+  Trigger<> *get_on_rx_high_watermark_trigger() { return &this->on_rx_high_watermark_; }
+  Trigger<std::vector<uint8_t>> *get_on_frame_trigger() { return &this->on_frame_; }
+  Trigger<std::vector<uint8_t>> *get_on_message_trigger() { return &this->on_message_; }
+
+  const ble_nus_common::TransportStats &get_stats() const { return this->stats_; }
+  uint16_t get_mtu() const { return this->mtu_; }
+  int8_t get_rssi() const { return this->rssi_; }
+
+#ifdef USE_SENSOR
+  void set_stats_update_interval(uint32_t interval_ms) { this->stats_update_interval_ms_ = interval_ms; }
+  SUB_SENSOR(bytes_sent)
+  SUB_SENSOR(bytes_received)
+  SUB_SENSOR(chunks_sent)
+  SUB_SENSOR(chunks_received)
+  SUB_SENSOR(dropped_bytes)
+  SUB_SENSOR(write_failures)
+  SUB_SENSOR(reconnects)
+  SUB_SENSOR(frame_errors)
+  SUB_SENSOR(compression_ratio)
+  SUB_SENSOR(mtu)
+  SUB_SENSOR(rssi)
+  SUB_SENSOR(rx_high_water)
+  SUB_SENSOR(tx_high_water)
+  SUB_SENSOR(tx_throughput)
+  SUB_SENSOR(rx_throughput)
+  SUB_SENSOR(data_length)
+  SUB_SENSOR(phy)
+#endif
 
  protected:
   void set_state_(FsmState state);
   void handle_state_();
+  void sleep_until_needed_();
   void send_next_chunk_in_ble_();
-  void defer_in_ble_(const std::function<void()> &fn);
+  void start_tx_();
+  void store_rx_chunk_(const uint8_t *data, size_t len);
+  void start_compression_();
+  void on_compression_read_(esp_gatt_status_t status, const uint8_t *value, uint16_t len);
+  void on_compression_write_(esp_gatt_status_t status);
+  void check_compression_();
+  void post_ble_work_(uint32_t work);
+  void drain_ble_work_();
   void watchdog_();
+  void update_conn_profile_();
+  bool data_queued_() const;
+  void negotiate_link_layer_();
+  void request_conn_profile_(ConnProfile profile);
+  bool tx_idle_() const;
+  void on_rx_consumed_();
+  void track_rx_level_();
+  bool pop_frame_(std::vector<uint8_t> &frame);
+  void dispatch_frames_();
+  void dispatch_messages_();
+  void send_requests_();
+  void match_requests_();
+  void check_requests_();
+  void finish_request_(RequestResult result, const std::vector<uint8_t> &response);
+  void fail_requests_(std::vector<ble_nus_common::RequestPipeline::Request> &&requests, RequestResult result);
+  void update_rx_flow_();
+  void set_rx_paused_(bool paused);
+  void track_tx_level_();
+  void check_flush_();
   bool maybe_autoconnect_();
+  void note_consumer_access_();
+  void maybe_keep_warm_();
+  void apply_security_params_();
+  void start_encryption_();
+  bool is_peer_bonded_();
   bool discover_characteristics_();
+  bool subscribe_notifications_();
+  bool load_cached_handles_();
+  void store_cached_handles_();
+  void invalidate_cached_handles_();
+#ifdef USE_SENSOR
+  void publish_stats_();
+#endif
   FsmState state_{FsmState::IDLE};
   FsmState last_reported_state_{FsmState::IDLE};
 
@@ -93,30 +297,87 @@ class BLENUSClientComponent : public uart::UARTComponent, public ble_client::BLE
   uint16_t mtu_{23};
   uint16_t desired_mtu_{247};
 
-  std::function<void()> ble_defer_fn_{nullptr};
+  std::atomic<uint32_t> ble_work_pending_{0};
 
   Trigger<> on_connected_;
   Trigger<> on_disconnected_;
   Trigger<> on_sent_;
   Trigger<> on_data_;
+  Trigger<bool> on_flush_complete_;
+  Trigger<> on_rx_high_watermark_;
+  Trigger<std::vector<uint8_t>> on_frame_;
+  Trigger<std::vector<uint8_t>> on_message_;
 
   uint16_t chr_commands_handle_{0};
   uint16_t chr_responses_handle_{0};
   uint16_t chr_cccd_handle_{0};
-
-  static constexpr size_t RX_BUFFER_CAPACITY = 512;
-  std::unique_ptr<esphome::ring_buffer::RingBuffer> rx_buffer_;
-
-  static constexpr size_t TX_BUFFER_CAPACITY = 512;
-  std::unique_ptr<esphome::ring_buffer::RingBuffer> tx_buffer_;
-
-  // single-byte peek cache
-  bool peek_valid_{false};
-  uint8_t peek_byte_{0};
-
-  std::vector<uint8_t> tx_queue_;
+  // 0 when the peer does not offer compression
+  uint16_t chr_compression_handle_{0};
+
+  // attribute handles persisted per peer address + service UUID, used to skip waiting for discovery
+  struct HandleCache {
+    uint64_t peer;
+    uint16_t commands;
+    uint16_t responses;
+    uint16_t cccd;
+    uint8_t indicate;
+    uint16_t compression;
+  } __attribute__((packed));
+  bool cache_handles_{false};
+  bool handles_from_cache_{false};
+  HandleCache handle_cache_{};
+  ESPPreferenceObject handle_cache_pref_;
+
+  size_t rx_buffer_size_{512};
+  std::unique_ptr<ble_nus_common::ByteRing> rx_buffer_;
+
+  size_t tx_buffer_size_{512};
+  std::unique_ptr<ble_nus_common::ByteRing> tx_buffer_;
+
+  bool buffers_in_psram_{false};
+  // watermarks in percent of buffer size, 0 disables tracking
+  uint8_t high_watermark_pct_{0};
+  uint8_t low_watermark_pct_{0};
+  ble_nus_common::Watermark rx_watermark_;
+  ble_nus_common::Watermark tx_watermark_;
+  ble_nus_common::RxOverflowPolicy rx_overflow_policy_{ble_nus_common::RxOverflowPolicy::DROP_NEWEST};
+  // RX switched off through the CCCD: PAUSE policy above the high watermark, or indication pacing
+  bool rx_paused_{false};
+  // framing: max_frame_size_ is clamped to what the RX buffer can hold; frame_dispatch_ feeds on_frame
+  // compression: negotiated once per link, see lz_codec.h
+  static constexpr size_t COMPRESS_INPUT_MAX = ble_nus_common::LZ_MAX_CHUNK_INPUT;
+  static constexpr uint32_t COMPRESSION_ANSWER_TIMEOUT_MS = 2000;
+  bool compression_{false};
+  CompressionState compression_state_{CompressionState::OFF};
+  uint32_t compression_request_ms_{0};
+  ble_nus_common::LzEncoder tx_encoder_;
+  ble_nus_common::LzDecoder rx_decoder_;
+  std::unique_ptr<uint8_t[]> tx_raw_;
+  bool framing_{false};
+  bool frame_dispatch_{false};
+  size_t max_frame_size_{0};
+  // message_dispatch_: on_message takes the RX stream and rx_messages_ decides where each message ends
+  bool message_dispatch_{false};
+  ble_nus_common::MessageCoalescer rx_messages_;
+  // transactions: the sent requests own the RX stream while any is outstanding
+  ble_nus_common::RequestPipeline requests_;
+  RxMode rx_mode_{RxMode::NOTIFY};
+  // resolved per link from rx_mode_ and the TX characteristic properties
+  bool rx_indicate_{false};
+
+  // staging area for one outgoing chunk, sized for the largest ATT payload (MTU 517 - 3)
+  static constexpr size_t MAX_CHUNK_PAYLOAD = 514;
+  std::unique_ptr<uint8_t[]> tx_chunk_;
   bool tx_in_progress_{false};
+  WriteMode write_mode_{WriteMode::WITH_RESPONSE};
+  // write-without-response pipelining: chunks handed to the stack but not yet reported by WRITE_CHAR_EVT
+  uint8_t tx_credits_{4};
+  uint8_t tx_in_flight_{0};
+  bool tx_congested_{false};
   uint32_t tx_flush_timeout_ms_{2000};
+  bool flush_pending_{false};
+  uint32_t flush_started_ms_{0};
+  std::vector<std::function<void(bool)>> flush_callbacks_;
 
   int last_error_{0};
 
@@ -126,13 +387,56 @@ class BLENUSClientComponent : public uart::UARTComponent, public ble_client::BLE
   uint32_t last_autoconnect_attempt_ms_{0};
   uint32_t reconnect_backoff_ms_{0};
 
+  // keep-warm: a poll burst starts with the first UART access after KEEP_WARM_BURST_GAP_MS of silence
+  static constexpr uint32_t KEEP_WARM_BURST_GAP_MS = 5000;
+  bool keep_warm_enabled_{false};
+  bool keep_warm_fired_{false};
+  uint32_t keep_warm_configured_interval_ms_{0};
+  uint32_t keep_warm_interval_ms_{0};
+  uint32_t keep_warm_lead_ms_{3000};
+  uint32_t last_access_ms_{0};
+  uint32_t last_burst_ms_{0};
+
+  ble_nus_common::LinkScheduler *scheduler_{nullptr};
+  uint32_t session_timeout_ms_{0};
+  bool slot_held_{false};
+
+  bool conn_profiles_enabled_{false};
+  ConnParams bulk_conn_params_{6, 12, 0, 200};
+  ConnParams idle_conn_params_{80, 160, 4, 600};
+  uint32_t conn_profile_idle_delay_ms_{3000};
+  ConnProfile conn_profile_{ConnProfile::NONE};
+  bool conn_profile_pending_{false};
+  uint32_t conn_profile_request_ms_{0};
+  static constexpr uint32_t CONN_PROFILE_RETRY_MS = 5000;
+  uint16_t conn_interval_{0};
+
+  // link layer: 0 leaves data length / PHY to the controller defaults
+  bool prefer_2m_phy_{false};
+  uint16_t desired_data_length_{0};
+  bool data_length_pending_{false};
+  uint16_t ll_tx_octets_{27};
+  uint16_t ll_rx_octets_{27};
+  uint8_t tx_phy_{1};
+  uint8_t rx_phy_{1};
+
   uint32_t state_enter_ms_{0};
   uint32_t state_timeout_ms_{5000};
 
+  ble_nus_common::TransportStats stats_;
+#ifdef USE_SENSOR
+  uint32_t stats_update_interval_ms_{0};
+  ble_nus_common::ThroughputWindow tx_rate_;
+  ble_nus_common::ThroughputWindow rx_rate_;
+#endif
+
   espbt::ESPBTUUID service_uuid_;
   espbt::ESPBTUUID rx_uuid_for_commands_;
   espbt::ESPBTUUID tx_uuid_for_responses_;
   uint32_t passkey_{0};
+  SecurityMode security_mode_{SecurityMode::PASSKEY_BOND};
+  bool resuming_bond_{false};
+  uint32_t connect_started_ms_{0};
   int8_t rssi_{0};
 };
 
@@ -0,0 +1,5 @@
+import esphome.codegen as cg
+
+CODEOWNERS = ["@latonita"]
+
+ble_nus_common_ns = cg.esphome_ns.namespace("ble_nus_common")
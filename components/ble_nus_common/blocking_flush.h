@@ -0,0 +1,50 @@
+#pragma once
+
+#include "esphome/core/application.h"
+#include "esphome/core/hal.h"
+#include "esphome/components/esp32_ble/ble.h"
+
+namespace esphome {
+namespace ble_nus_common {
+
+/// Nesting depth of BLE event dispatch started by wait_tx_drained() or reaching NUS handlers, shared by all
+/// clients and servers.
+inline int &ble_dispatch_depth() {
+  static int depth = 0;
+  return depth;
+}
+
+/// Marks a BLE event handler, or a blocking flush, as running for its lifetime.
+class BleDispatchScope {
+ public:
+  BleDispatchScope() { ble_dispatch_depth()++; }
+  ~BleDispatchScope() { ble_dispatch_depth()--; }
+  BleDispatchScope(const BleDispatchScope &) = delete;
+  BleDispatchScope &operator=(const BleDispatchScope &) = delete;
+};
+
+/// Bounded blocking wait for TX to drain. TX completions arrive as BLE events that ESP32BLE dispatches from the
+/// main loop, so the wait dispatches them itself and calls `pump` (which sends what the stack has room for)
+/// between rounds. Returns false without waiting when called from inside a BLE event: dispatching again from
+/// there would re-enter the handlers. That covers every callback run by ESP32BLE's own loop, whatever component
+/// it belongs to (NUS triggers, esp32_ble_server characteristic writes, ble_client or tracker automations), and
+/// NUS handlers reached from a wait in progress. The caller then completes asynchronously.
+template<typename Idle, typename Pump> bool wait_tx_drained(uint32_t timeout_ms, Idle &&idle, Pump &&pump) {
+  if (ble_dispatch_depth() > 0 || esp32_ble::global_ble == nullptr ||
+      App.get_current_component() == esp32_ble::global_ble) {
+    return false;
+  }
+  BleDispatchScope scope;
+  const uint32_t start = millis();
+  pump();
+  while (!idle() && millis() - start <= timeout_ms) {
+    esp32_ble::global_ble->loop();
+    pump();
+    App.feed_wdt();
+    delay(1);
+  }
+  return true;
+}
+
+}  // namespace ble_nus_common
+}  // namespace esphome
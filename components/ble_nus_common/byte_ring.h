@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <span>
+
+namespace esphome {
+namespace ble_nus_common {
+
+/// Single-producer/single-consumer lock-free byte ring used for NUS RX/TX.
+///
+/// The producer owns `head_`, the consumer owns `tail_`. Both run over `[0, 2 * capacity)`, so the fill level is
+/// `head_ - tail_` modulo twice the capacity and no slot is sacrificed to tell "full" from "empty". Besides
+/// copying `write()`/`read()` it exposes contiguous spans (`writable()`/`commit()`, `readable()`/`consume()`) and
+/// offset peeks, so parsers can inspect data in place. Depends only on the standard library and builds on the host.
+class ByteRing {
+ public:
+  using ReleaseFn = void (*)(uint8_t *storage, size_t capacity);
+
+  static std::unique_ptr<ByteRing> create(size_t capacity) {
+    if (capacity == 0) {
+      return nullptr;
+    }
+    uint8_t *storage = new (std::nothrow) uint8_t[capacity];
+    if (storage == nullptr) {
+      return nullptr;
+    }
+    return adopt(storage, capacity, [](uint8_t *p, size_t) { delete[] p; });
+  }
+  /// Wraps caller-allocated storage (e.g. PSRAM); `release` is called with it on destruction.
+  static std::unique_ptr<ByteRing> adopt(uint8_t *storage, size_t capacity, ReleaseFn release) {
+    if (storage == nullptr || capacity == 0) {
+      return nullptr;
+    }
+    return std::unique_ptr<ByteRing>(new ByteRing(storage, capacity, release));
+  }
+
+  ~ByteRing() {
+    if (this->release_ != nullptr) {
+      this->release_(this->storage_, this->capacity_);
+    }
+  }
+  ByteRing(const ByteRing &) = delete;
+  ByteRing &operator=(const ByteRing &) = delete;
+
+  size_t capacity() const { return this->capacity_; }
+  size_t available() const {
+    return this->distance_(this->tail_.load(std::memory_order_acquire), this->head_.load(std::memory_order_acquire));
+  }
+  size_t free() const { return this->capacity_ - this->available(); }
+  bool empty() const { return this->available() == 0; }
+
+  // -- producer side --
+
+  /// Largest contiguous free region starting at the write position.
+  std::span<uint8_t> writable() const {
+    const size_t head = this->head_.load(std::memory_order_relaxed);
+    const size_t room = this->capacity_ - this->distance_(this->tail_.load(std::memory_order_acquire), head);
+    const size_t pos = this->index_(head);
+    return {this->storage_ + pos, std::min(room, this->capacity_ - pos)};
+  }
+  /// Publishes `len` bytes previously filled through `writable()`.
+  void commit(size_t len) {
+    this->head_.store(this->advance_(this->head_.load(std::memory_order_relaxed), len), std::memory_order_release);
+  }
+
+  /// Copies in as much of `data` as fits, returns the number of bytes stored.
+  size_t write(const uint8_t *data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+      auto span = this->writable();
+      if (span.empty()) {
+        break;
+      }
+      const size_t n = std::min(span.size(), len - done);
+      std::memcpy(span.data(), data + done, n);
+      this->commit(n);
+      done += n;
+    }
+    return done;
+  }
+
+  // -- consumer side --
+
+  /// Largest contiguous readable region starting `offset` bytes past the read position.
+  std::span<const uint8_t> readable(size_t offset = 0) const {
+    const size_t tail = this->tail_.load(std::memory_order_relaxed);
+    const size_t filled = this->distance_(tail, this->head_.load(std::memory_order_acquire));
+    if (offset >= filled) {
+      return {};
+    }
+    const size_t pos = this->index_(this->advance_(tail, offset));
+    return {this->storage_ + pos, std::min(filled - offset, this->capacity_ - pos)};
+  }
+  /// Releases `len` bytes from the front of the ring.
+  void consume(size_t len) {
+    len = std::min(len, this->available());
+    this->tail_.store(this->advance_(this->tail_.load(std::memory_order_relaxed), len), std::memory_order_release);
+  }
+
+  /// Copies up to `len` bytes starting `offset` bytes into the readable data, without consuming.
+  size_t peek(uint8_t *dst, size_t len, size_t offset = 0) const {
+    const size_t filled = this->available();
+    if (offset >= filled) {
+      return 0;
+    }
+    len = std::min(len, filled - offset);
+    const size_t pos = this->index_(this->advance_(this->tail_.load(std::memory_order_relaxed), offset));
+    const size_t first = std::min(len, this->capacity_ - pos);
+    std::memcpy(dst, this->storage_ + pos, first);
+    std::memcpy(dst + first, this->storage_, len - first);
+    return len;
+  }
+  /// The `len` bytes starting `offset` past the read position, in place when they are contiguous, otherwise
+  /// copied into `staging` (which must hold `len` bytes). Never allocates.
+  const uint8_t *peek_contiguous(size_t len, uint8_t *staging, size_t offset = 0) const {
+    auto span = this->readable(offset);
+    if (span.size() >= len) {
+      return span.data();
+    }
+    this->peek(staging, len, offset);
+    return staging;
+  }
+  bool peek_byte(uint8_t *dst, size_t offset = 0) const {
+    if (offset >= this->available()) {
+      return false;
+    }
+    *dst = this->storage_[this->index_(this->advance_(this->tail_.load(std::memory_order_relaxed), offset))];
+    return true;
+  }
+
+  /// Copies out and consumes up to `len` bytes, returns the number of bytes read.
+  size_t read(uint8_t *dst, size_t len) {
+    const size_t n = this->peek(dst, len);
+    this->consume(n);
+    return n;
+  }
+
+  /// Drops all content. Only valid while neither side is active.
+  void reset() { this->tail_.store(this->head_.load(std::memory_order_acquire), std::memory_order_release); }
+
+ protected:
+  ByteRing(uint8_t *storage, size_t capacity, ReleaseFn release)
+      : storage_(storage), capacity_(capacity), release_(release) {}
+
+  size_t distance_(size_t from, size_t to) const { return to >= from ? to - from : to + 2 * this->capacity_ - from; }
+  size_t advance_(size_t pos, size_t len) const {
+    pos += len;
+    return pos >= 2 * this->capacity_ ? pos - 2 * this->capacity_ : pos;
+  }
+  size_t index_(size_t pos) const { return pos >= this->capacity_ ? pos - this->capacity_ : pos; }
+
+  uint8_t *const storage_;
+  const size_t capacity_;
+  const ReleaseFn release_;
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+};
+
+/// Searches the first `limit` readable bytes of `ring` for `needle`. The search starts at `*scanned` and leaves
+/// there how far it got, so a caller polling a growing ring never searches the same bytes twice. Returns the
+/// length up to and including the match, or 0.
+inline size_t ring_find(const ByteRing &ring, const uint8_t *needle, size_t needle_len, size_t limit,
+                        size_t *scanned) {
+  if (needle_len == 0) {
+    return 0;
+  }
+  uint8_t block[32];
+  for (size_t pos = std::min(*scanned, limit); pos < limit;) {
+    const size_t n = ring.peek(block, std::min(sizeof(block), limit - pos), pos);
+    for (size_t i = 0; i < n; i++) {
+      const size_t end = pos + i + 1;
+      if (block[i] != needle[needle_len - 1] || end < needle_len) {
+        continue;
+      }
+      size_t k = 1;
+      uint8_t byte;
+      while (k < needle_len && ring.peek_byte(&byte, end - 1 - k) && byte == needle[needle_len - 1 - k]) {
+        k++;
+      }
+      if (k == needle_len) {
+        return end;
+      }
+    }
+    pos += n;
+    *scanned = pos;
+  }
+  return 0;
+}
+
+}  // namespace ble_nus_common
+}  // namespace esphome
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "byte_ring.h"
+
+namespace esphome {
+namespace ble_nus_common {
+
+/// Optional message framing on top of the NUS byte pipe:
+///
+///   [0xA5][len lo][len hi][payload ...][crc lo][crc hi]
+///
+/// The CRC is CRC-16/CCITT-FALSE over the two length bytes and the payload. Frames are assembled in the RX ring,
+/// so a frame may arrive split over any number of ATT payloads.
+static constexpr uint8_t FRAME_SOF = 0xA5;
+static constexpr size_t FRAME_HEADER_SIZE = 3;
+static constexpr size_t FRAME_TRAILER_SIZE = 2;
+static constexpr size_t FRAME_OVERHEAD = FRAME_HEADER_SIZE + FRAME_TRAILER_SIZE;
+static constexpr size_t FRAME_MAX_PAYLOAD = 0xFFFF;
+
+inline uint16_t frame_crc16(const uint8_t *data, size_t len, uint16_t crc = 0xFFFF) {
+  for (size_t i = 0; i < len; i++) {
+    crc ^= static_cast<uint16_t>(data[i]) << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+    }
+  }
+  return crc;
+}
+
+enum class FrameStatus : uint8_t {
+  NEED_MORE,  // the front of the ring may still become a valid frame
+  COMPLETE,   // a valid frame starts at the front of the ring
+  INVALID,    // the first byte cannot start a valid frame
+};
+
+/// Checks whether a valid frame starts at the front of `ring`, without consuming anything.
+/// On COMPLETE, `payload_len` is set.
+inline FrameStatus probe_frame(const ByteRing &ring, size_t max_payload, size_t *payload_len) {
+  uint8_t header[FRAME_HEADER_SIZE];
+  if (ring.peek(header, 1) == 0) {
+    return FrameStatus::NEED_MORE;
+  }
+  if (header[0] != FRAME_SOF) {
+    return FrameStatus::INVALID;
+  }
+  if (ring.peek(header, FRAME_HEADER_SIZE) < FRAME_HEADER_SIZE) {
+    return FrameStatus::NEED_MORE;
+  }
+  const size_t len = header[1] | (static_cast<size_t>(header[2]) << 8);
+  if (len > max_payload) {
+    return FrameStatus::INVALID;
+  }
+  if (ring.available() < len + FRAME_OVERHEAD) {
+    return FrameStatus::NEED_MORE;
+  }
+  // CRC straight over the ring, in small blocks so nothing is allocated for a frame that may be rejected
+  uint16_t crc = frame_crc16(header + 1, 2);
+  uint8_t block[32];
+  for (size_t done = 0; done < len;) {
+    const size_t n = ring.peek(block, std::min(sizeof(block), len - done), FRAME_HEADER_SIZE + done);
+    crc = frame_crc16(block, n, crc);
+    done += n;
+  }
+  uint8_t trailer[FRAME_TRAILER_SIZE];
+  ring.peek(trailer, FRAME_TRAILER_SIZE, FRAME_HEADER_SIZE + len);
+  if ((trailer[0] | (trailer[1] << 8)) != crc) {
+    return FrameStatus::INVALID;
+  }
+  *payload_len = len;
+  return FrameStatus::COMPLETE;
+}
+
+/// Removes the next valid frame from `ring` and stores its payload in `out`. Leading bytes that cannot start a
+/// valid frame are discarded and added to `skipped`. Returns false while no complete frame is buffered.
+inline bool pop_frame(ByteRing &ring, size_t max_payload, std::vector<uint8_t> &out, size_t &skipped) {
+  size_t len = 0;
+  while (true) {
+    switch (probe_frame(ring, max_payload, &len)) {
+      case FrameStatus::NEED_MORE:
+        return false;
+      case FrameStatus::INVALID:
+        ring.consume(1);
+        skipped++;
+        continue;
+      case FrameStatus::COMPLETE:
+        out.resize(len);
+        ring.consume(FRAME_HEADER_SIZE);
+        ring.read(out.data(), len);
+        ring.consume(FRAME_TRAILER_SIZE);
+        return true;
+    }
+  }
+}
+
+/// Writes `payload` as one frame. All-or-nothing: returns false and writes nothing if it does not fit.
+inline bool push_frame(ByteRing &ring, const uint8_t *payload, size_t len) {
+  if (len > FRAME_MAX_PAYLOAD || ring.free() < len + FRAME_OVERHEAD) {
+    return false;
+  }
+  const uint8_t header[FRAME_HEADER_SIZE] = {FRAME_SOF, static_cast<uint8_t>(len), static_cast<uint8_t>(len >> 8)};
+  const uint16_t crc = frame_crc16(payload, len, frame_crc16(header + 1, 2));
+  const uint8_t trailer[FRAME_TRAILER_SIZE] = {static_cast<uint8_t>(crc), static_cast<uint8_t>(crc >> 8)};
+  ring.write(header, FRAME_HEADER_SIZE);
+  ring.write(payload, len);
+  ring.write(trailer, FRAME_TRAILER_SIZE);
+  return true;
+}
+
+}  // namespace ble_nus_common
+}  // namespace esphome
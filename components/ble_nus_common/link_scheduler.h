@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+namespace ble_nus_common {
+
+/// A link whose connections are granted by a LinkScheduler instead of being opened at will.
+class ScheduledLink {
+ public:
+  virtual ~ScheduledLink() = default;
+  /// A connection slot is now held by this link; it should connect.
+  virtual void on_slot_granted() = 0;
+  /// The slot is being taken back (deadline reached, or drained while others wait); the link should disconnect.
+  /// The slot stays held until the link calls LinkScheduler::release().
+  virtual void on_slot_revoked() = 0;
+  /// True while connected with nothing queued in either direction.
+  virtual bool is_link_drained() const = 0;
+};
+
+/// Arbitrates a limited number of concurrent connections between several links.
+class LinkScheduler {
+ public:
+  virtual ~LinkScheduler() = default;
+  virtual void register_link(ScheduledLink *link, uint32_t session_timeout_ms) = 0;
+  /// Queues `link` for a slot; no-op if it is already queued or holding one.
+  virtual void request(ScheduledLink *link) = 0;
+  /// Gives back the slot (or the queue position) held by `link`.
+  virtual void release(ScheduledLink *link) = 0;
+};
+
+}  // namespace ble_nus_common
+}  // namespace esphome
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace esphome {
+namespace ble_nus_common {
+
+/// Small-footprint LZSS for NUS chunks, with a 256-byte sliding history shared by both ends of a link.
+///
+/// Every compressed chunk starts with a header byte: LZ_CHUNK_RAW (payload follows as is) or LZ_CHUNK_LZ.
+/// An LZ payload is a sequence of groups. Each group has a flag byte and up to 8 items, where flag bit i set
+/// means item i is a match:
+///   literal: [byte]
+///   match:   [distance - 1][length - LZ_MIN_MATCH]   distance 1..256, length 3..258
+/// Raw and LZ chunks both feed the history, and it carries over from one chunk to the next. Both ends must
+/// therefore see every chunk, in order, and reset together when a link comes up.
+///
+/// Compression is negotiated per link, outside the data stream. A peripheral that offers it adds a characteristic
+/// with LZ_CHAR_UUID to the NUS service; reading it returns LZ_VERSION. The central checks the version and
+/// writes it back, with a response, to switch the link over. Chunk headers appear only after that write.
+/// Peers without the characteristic never see any of this.
+static constexpr uint8_t LZ_CHUNK_RAW = 0x00;
+static constexpr uint8_t LZ_CHUNK_LZ = 0x01;
+static constexpr uint8_t LZ_VERSION = 1;
+static constexpr const char *LZ_CHAR_UUID = "8A1C0001-53C7-4E4B-9A0B-4C5A436F6D70";
+static constexpr size_t LZ_WINDOW = 256;
+static constexpr size_t LZ_MIN_MATCH = 3;
+static constexpr size_t LZ_MAX_MATCH = LZ_MIN_MATCH + 255;
+/// Most input an encoder may put into one chunk, and so the most one chunk may decode to. Receivers size their
+/// flow control by it; the decoder rejects chunks that exceed it.
+static constexpr size_t LZ_MAX_CHUNK_INPUT = 1024;
+
+/// The last LZ_WINDOW bytes of the uncompressed stream.
+class LzHistory {
+ public:
+  void reset() {
+    this->pos_ = 0;
+    this->filled_ = 0;
+  }
+  void push(uint8_t byte) {
+    this->buf_[this->pos_] = byte;
+    this->pos_ = static_cast<uint8_t>(this->pos_ + 1);
+    if (this->filled_ < LZ_WINDOW) {
+      this->filled_++;
+    }
+  }
+  /// Byte `distance` positions back, 1 being the most recent.
+  uint8_t back(size_t distance) const { return this->buf_[static_cast<uint8_t>(this->pos_ - distance)]; }
+  size_t filled() const { return this->filled_; }
+
+ protected:
+  uint8_t buf_[LZ_WINDOW];
+  uint8_t pos_{0};
+  size_t filled_{0};
+};
+
+class LzEncoder {
+ public:
+  void reset() { this->history_.reset(); }
+
+  /// Encodes a prefix of `in` as one chunk (header included) of at most `out_cap` bytes. Returns the chunk size
+  /// and sets `consumed` to the number of input bytes it carries. Falls back to a raw chunk when LZ does not pay.
+  size_t encode_chunk(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_cap, size_t *consumed) {
+    *consumed = 0;
+    if (out_cap < 3 || in_len == 0) {
+      return 0;
+    }
+    // the search reads the history as it was before this chunk, so commit only afterwards
+    size_t used = 0;
+    const size_t lz_len = this->encode_(in, in_len, out + 1, out_cap - 1, &used);
+    if (lz_len < used) {
+      out[0] = LZ_CHUNK_LZ;
+    } else {
+      // no gain; the raw bytes fit because they are no longer than the LZ attempt
+      out[0] = LZ_CHUNK_RAW;
+      std::memcpy(out + 1, in, used);
+    }
+    for (size_t i = 0; i < used; i++) {
+      this->history_.push(in[i]);
+    }
+    *consumed = used;
+    return 1 + (out[0] == LZ_CHUNK_LZ ? lz_len : used);
+  }
+
+ protected:
+  // byte `distance` positions before in[pos], reaching into the history when needed
+  uint8_t back_(const uint8_t *in, size_t pos, size_t distance) const {
+    return distance <= pos ? in[pos - distance] : this->history_.back(distance - pos);
+  }
+
+  size_t encode_(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_cap, size_t *consumed) const {
+    size_t pos = 0;
+    size_t len = 0;
+    size_t flag_at = 0;
+    int items = 8;
+    while (pos < in_len) {
+      const size_t group = items == 8 ? 1 : 0;
+      if (len + group + 1 > out_cap) {
+        break;
+      }
+      // longest match within the window, brute force: the window is small and chunks are short
+      size_t best_len = 0;
+      size_t best_dist = 0;
+      const size_t window = std::min(LZ_WINDOW, this->history_.filled() + pos);
+      const size_t limit = std::min(LZ_MAX_MATCH, in_len - pos);
+      if (limit >= LZ_MIN_MATCH && len + group + 2 <= out_cap) {
+        for (size_t dist = 1; dist <= window && best_len < limit; dist++) {
+          size_t n = 0;
+          while (n < limit && this->back_(in, pos + n, dist) == in[pos + n]) {
+            n++;
+          }
+          if (n > best_len) {
+            best_len = n;
+            best_dist = dist;
+          }
+        }
+      }
+      if (items == 8) {
+        flag_at = len++;
+        out[flag_at] = 0;
+        items = 0;
+      }
+      if (best_len >= LZ_MIN_MATCH) {
+        out[flag_at] |= 1 << items;
+        out[len++] = static_cast<uint8_t>(best_dist - 1);
+        out[len++] = static_cast<uint8_t>(best_len - LZ_MIN_MATCH);
+        pos += best_len;
+      } else {
+        out[len++] = in[pos++];
+      }
+      items++;
+    }
+    *consumed = pos;
+    return len;
+  }
+
+  LzHistory history_;
+};
+
+class LzDecoder {
+ public:
+  void reset() { this->history_.reset(); }
+
+  /// Decodes one chunk and hands the output to `sink(const uint8_t *data, size_t len)` in pieces.
+  /// Returns false on a malformed chunk, after which the stream cannot be trusted.
+  template<typename Sink> bool decode_chunk(const uint8_t *in, size_t len, Sink &&sink) {
+    if (len == 0) {
+      return false;
+    }
+    if (in[0] == LZ_CHUNK_RAW) {
+      for (size_t i = 1; i < len; i++) {
+        this->history_.push(in[i]);
+      }
+      sink(in + 1, len - 1);
+      return true;
+    }
+    if (in[0] != LZ_CHUNK_LZ) {
+      return false;
+    }
+    uint8_t block[64];
+    size_t filled = 0;
+    size_t total = 0;
+    size_t pos = 1;
+    while (pos < len) {
+      const uint8_t flags = in[pos++];
+      for (int item = 0; item < 8 && pos < len; item++) {
+        size_t run = 1;
+        size_t dist = 0;
+        if (flags & (1 << item)) {
+          if (pos + 2 > len) {
+            return false;
+          }
+          dist = in[pos] + 1;
+          run = in[pos + 1] + LZ_MIN_MATCH;
+          pos += 2;
+          if (dist > this->history_.filled()) {
+            return false;
+          }
+        }
+        total += run;
+        if (total > LZ_MAX_CHUNK_INPUT) {
+          return false;
+        }
+        for (size_t i = 0; i < run; i++) {
+          const uint8_t byte = dist == 0 ? in[pos++] : this->history_.back(dist);
+          this->history_.push(byte);
+          block[filled++] = byte;
+          if (filled == sizeof(block)) {
+            sink(block, filled);
+            filled = 0;
+          }
+        }
+      }
+    }
+    if (filled > 0) {
+      sink(block, filled);
+    }
+    return true;
+  }
+
+ protected:
+  LzHistory history_;
+};
+
+}  // namespace ble_nus_common
+}  // namespace esphome
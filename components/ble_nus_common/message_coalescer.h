@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "byte_ring.h"
+
+namespace esphome {
+namespace ble_nus_common {
+
+/// Cuts the RX stream into messages for a data-bearing trigger, straight out of the RX ring. A message ends at
+/// the first of:
+///   - the delimiter, which stays at the end of the message,
+///   - `max_size` bytes,
+///   - `idle_gap` without new bytes (0 disables),
+///   - `max_latency` after its first byte arrived (0 disables).
+/// Times are milliseconds from the caller's clock, so the class stays free of platform calls.
+class MessageCoalescer {
+ public:
+  static constexpr size_t MAX_DELIMITER = 8;
+
+  void configure(uint32_t idle_gap_ms, size_t max_size, uint32_t max_latency_ms, const uint8_t *delimiter,
+                 size_t delimiter_len) {
+    this->idle_gap_ms_ = idle_gap_ms;
+    this->max_size_ = std::max<size_t>(max_size, 1);
+    this->max_latency_ms_ = max_latency_ms;
+    this->delimiter_len_ = std::min(delimiter_len, MAX_DELIMITER);
+    std::memcpy(this->delimiter_, delimiter, this->delimiter_len_);
+  }
+  /// A message can never be larger than the ring holding it.
+  void clamp_max_size(size_t capacity) { this->max_size_ = std::min(this->max_size_, capacity); }
+  size_t max_size() const { return this->max_size_; }
+  uint32_t idle_gap_ms() const { return this->idle_gap_ms_; }
+  uint32_t max_latency_ms() const { return this->max_latency_ms_; }
+  size_t delimiter_len() const { return this->delimiter_len_; }
+
+  void reset() {
+    this->pending_ = false;
+    this->scanned_ = 0;
+  }
+
+  /// Bytes left the front of the ring through another reader. The delimiter search starts over; the buffered
+  /// rest keeps its timing.
+  void on_consumed() { this->scanned_ = 0; }
+
+  /// Bytes were appended to the ring at `now`.
+  void on_rx(uint32_t now) {
+    if (!this->pending_) {
+      this->pending_ = true;
+      this->first_ms_ = now;
+    }
+    this->last_ms_ = now;
+  }
+
+  /// Moves the next complete message from `ring` into `out`. Returns false while the buffered bytes may still
+  /// grow into a longer message.
+  bool pop(ByteRing &ring, uint32_t now, std::vector<uint8_t> &out) {
+    const size_t available = ring.available();
+    if (available == 0 || !this->pending_) {
+      // someone else read the ring empty, or nothing arrived since the last message
+      this->reset();
+      return false;
+    }
+    const size_t limit = std::min(available, this->max_size_);
+    size_t len = ring_find(ring, this->delimiter_, this->delimiter_len_, limit, &this->scanned_);
+    if (len == 0) {
+      if (available < this->max_size_ && !this->expired_(now)) {
+        return false;
+      }
+      len = limit;
+    }
+    out.resize(len);
+    ring.read(out.data(), len);
+    this->scanned_ = 0;
+    // what is left arrived with the latest chunk at the earliest, and starts the next message
+    this->pending_ = !ring.empty();
+    this->first_ms_ = this->last_ms_;
+    return true;
+  }
+
+  /// When pop() would cut the buffered bytes without further RX; false while nothing is buffered or only a
+  /// delimiter or max_size can end the message.
+  bool next_deadline(uint32_t *deadline) const {
+    if (!this->pending_ || (this->idle_gap_ms_ == 0 && this->max_latency_ms_ == 0)) {
+      return false;
+    }
+    const uint32_t gap = this->last_ms_ + this->idle_gap_ms_;
+    const uint32_t latency = this->first_ms_ + this->max_latency_ms_;
+    if (this->idle_gap_ms_ == 0) {
+      *deadline = latency;
+    } else if (this->max_latency_ms_ == 0) {
+      *deadline = gap;
+    } else {
+      *deadline = static_cast<int32_t>(gap - latency) < 0 ? gap : latency;
+    }
+    return true;
+  }
+
+ protected:
+  bool expired_(uint32_t now) const {
+    return (this->idle_gap_ms_ > 0 && now - this->last_ms_ >= this->idle_gap_ms_) ||
+           (this->max_latency_ms_ > 0 && now - this->first_ms_ >= this->max_latency_ms_);
+  }
+
+  uint32_t idle_gap_ms_{20};
+  size_t max_size_{256};
+  uint32_t max_latency_ms_{0};
+  uint8_t delimiter_[MAX_DELIMITER]{};
+  size_t delimiter_len_{0};
+
+  bool pending_{false};
+  uint32_t first_ms_{0};
+  uint32_t last_ms_{0};
+  size_t scanned_{0};
+};
+
+}  // namespace ble_nus_common
+}  // namespace esphome
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "byte_ring.h"
+#include "response_matcher.h"
+
+namespace esphome {
+namespace ble_nus_common {
+
+enum class RequestResult : uint8_t {
+  OK,
+  TIMEOUT,       // no complete response within the request's timeout
+  DISCONNECTED,  // the link dropped after the request was sent
+};
+using RequestCallback = std::function<void(RequestResult result, const std::vector<uint8_t> &response)>;
+
+/// Request/response transactions over one RX stream. Up to `max_outstanding` requests are sent ahead of their
+/// predecessors' responses, which arrive in send order, so the sent requests always form the front of the queue
+/// and the head's matcher owns the stream. The caller writes the data, consumes the responses and calls the
+/// callbacks of the requests handed back to it. Times are milliseconds from the caller's clock.
+class RequestPipeline {
+ public:
+  struct Request {
+    std::vector<uint8_t> data;
+    ResponseMatcher matcher;
+    uint32_t timeout_ms;
+    RequestCallback callback;
+    bool sent;
+  };
+
+  void set_max_outstanding(uint8_t count) { this->max_outstanding_ = count > 0 ? count : 1; }
+  uint8_t max_outstanding() const { return this->max_outstanding_; }
+  size_t size() const { return this->queue_.size(); }
+  bool empty() const { return this->queue_.empty(); }
+  /// Requests on the air, waiting for their responses.
+  size_t sent() const { return this->sent_; }
+  /// When the head request began waiting.
+  uint32_t started_ms() const { return this->started_ms_; }
+
+  void push(std::vector<uint8_t> data, ResponseMatcher matcher, uint32_t timeout_ms, RequestCallback &&callback,
+            uint32_t now) {
+    if (this->queue_.empty()) {
+      this->started_ms_ = now;
+    }
+    this->queue_.push_back({std::move(data), std::move(matcher), timeout_ms, std::move(callback), false});
+  }
+
+  /// The next request to write, or nullptr while none is queued or `max_outstanding` are on the air.
+  const Request *next_unsent() const {
+    if (this->sent_ >= this->queue_.size() || this->sent_ >= this->max_outstanding_) {
+      return nullptr;
+    }
+    return &this->queue_[this->sent_];
+  }
+  /// Marks next_unsent() as written and hands over its data.
+  std::vector<uint8_t> mark_sent() {
+    Request &request = this->queue_[this->sent_++];
+    request.sent = true;
+    return std::move(request.data);
+  }
+
+  /// Length of the head's complete response at the front of `ring`, or 0 while more is needed or nothing is
+  /// on the air.
+  size_t match(const ByteRing &ring) {
+    return this->sent_ > 0 ? this->queue_.front().matcher.match(ring, this->scratch_) : 0;
+  }
+  /// The ring front moved under the head's matcher; its search starts over.
+  void on_consumed() {
+    if (!this->queue_.empty()) {
+      this->queue_.front().matcher.reset();
+    }
+  }
+
+  /// Deadline of the head request, if it has a timeout.
+  bool next_deadline(uint32_t *deadline) const {
+    if (this->queue_.empty() || this->queue_.front().timeout_ms == 0) {
+      return false;
+    }
+    *deadline = this->started_ms_ + this->queue_.front().timeout_ms;
+    return true;
+  }
+  bool timed_out(uint32_t now) const {
+    return !this->queue_.empty() && this->queue_.front().timeout_ms > 0 &&
+           now - this->started_ms_ >= this->queue_.front().timeout_ms;
+  }
+
+  /// Takes the head request out; the next one starts waiting at `now`.
+  Request pop(uint32_t now) {
+    Request request = std::move(this->queue_.front());
+    this->queue_.pop_front();
+    if (request.sent) {
+      this->sent_--;
+    }
+    this->started_ms_ = now;
+    return request;
+  }
+  /// Takes out every request on the air.
+  std::vector<Request> pop_sent(uint32_t now) {
+    std::vector<Request> requests;
+    while (this->sent_ > 0) {
+      requests.push_back(this->pop(now));
+    }
+    return requests;
+  }
+  /// Takes out what a timeout of the head fails. An unsent head goes alone. A sent head takes every sent request
+  /// with it: the stream has lost step with them, and later responses may already sit behind the missing one.
+  std::vector<Request> pop_timed_out(uint32_t now) {
+    if (this->sent_ > 0) {
+      return this->pop_sent(now);
+    }
+    std::vector<Request> requests;
+    requests.push_back(this->pop(now));
+    return requests;
+  }
+
+ protected:
+  std::deque<Request> queue_;
+  size_t sent_{0};
+  uint8_t max_outstanding_{1};
+  uint32_t started_ms_{0};
+  std::vector<uint8_t> scratch_;
+};
+
+}  // namespace ble_nus_common
+}  // namespace esphome
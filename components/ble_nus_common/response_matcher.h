@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "byte_ring.h"
+
+namespace esphome {
+namespace ble_nus_common {
+
+/// Decides where the response to a request ends in the RX ring: after a terminator, after a fixed number of
+/// bytes, or wherever a predicate says. A matcher only inspects the ring; the caller consumes the response.
+class ResponseMatcher {
+ public:
+  /// Gets the buffered bytes and returns the length of the complete response at their front, or 0 for more.
+  using Predicate = std::function<size_t(const uint8_t *data, size_t len)>;
+
+  /// Response ends with `terminator`, which is part of it.
+  static ResponseMatcher terminator(std::vector<uint8_t> terminator) {
+    ResponseMatcher matcher;
+    matcher.terminator_ = std::move(terminator);
+    return matcher;
+  }
+  /// Response is exactly `len` bytes.
+  static ResponseMatcher length(size_t len) {
+    ResponseMatcher matcher;
+    matcher.length_ = len;
+    return matcher;
+  }
+  static ResponseMatcher predicate(Predicate predicate) {
+    ResponseMatcher matcher;
+    matcher.predicate_ = std::move(predicate);
+    return matcher;
+  }
+
+  /// Length of the complete response at the front of `ring`, or 0 while more is needed. A predicate sees the
+  /// ring contiguously; only data that wraps is copied, into `scratch`.
+  size_t match(const ByteRing &ring, std::vector<uint8_t> &scratch) {
+    const size_t available = ring.available();
+    if (available == 0) {
+      return 0;
+    }
+    if (!this->terminator_.empty()) {
+      return ring_find(ring, this->terminator_.data(), this->terminator_.size(), available, &this->scanned_);
+    }
+    if (this->predicate_) {
+      auto span = ring.readable();
+      const uint8_t *data = span.data();
+      if (span.size() < available) {
+        scratch.resize(available);
+        ring.peek(scratch.data(), available);
+        data = scratch.data();
+      }
+      return std::min(this->predicate_(data, available), available);
+    }
+    return this->length_ > 0 && available >= this->length_ ? this->length_ : 0;
+  }
+
+  /// Forgets search progress; call when the ring front changes under the matcher.
+  void reset() { this->scanned_ = 0; }
+
+ protected:
+  std::vector<uint8_t> terminator_;
+  size_t length_{0};
+  Predicate predicate_;
+  size_t scanned_{0};
+};
+
+}  // namespace ble_nus_common
+}  // namespace esphome
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "esphome/core/helpers.h"
+
+#include "byte_ring.h"
+
+namespace esphome {
+namespace ble_nus_common {
+
+/// Allocates a ByteRing through ESPHome's RAMAllocator. With `prefer_psram` the storage goes to external RAM when
+/// available and falls back to internal RAM otherwise.
+inline std::unique_ptr<ByteRing> create_byte_ring(size_t capacity, bool prefer_psram) {
+  using Allocator = RAMAllocator<uint8_t>;
+  Allocator allocator(prefer_psram ? Allocator::NONE : Allocator::ALLOC_INTERNAL);
+  uint8_t *storage = allocator.allocate(capacity);
+  return ByteRing::adopt(storage, capacity, [](uint8_t *p, size_t n) { Allocator(Allocator::NONE).deallocate(p, n); });
+}
+
+}  // namespace ble_nus_common
+}  // namespace esphome
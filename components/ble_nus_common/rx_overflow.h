@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "byte_ring.h"
+
+namespace esphome {
+namespace ble_nus_common {
+
+enum class RxOverflowPolicy : uint8_t {
+  DROP_NEWEST,  // keep what is buffered, lose the tail of the incoming chunk
+  DROP_OLDEST,  // make room by discarding the oldest unread bytes
+  PAUSE,        // throttle the peer at the high watermark; anything that still overflows is dropped as newest
+};
+
+inline const char *rx_overflow_policy_to_str(RxOverflowPolicy policy) {
+  switch (policy) {
+    case RxOverflowPolicy::DROP_OLDEST:
+      return "drop_oldest";
+    case RxOverflowPolicy::PAUSE:
+      return "pause";
+    case RxOverflowPolicy::DROP_NEWEST:
+    default:
+      return "drop_newest";
+  }
+}
+
+/// Stores an incoming chunk into `ring` according to `policy` and returns the number of bytes lost.
+/// DROP_OLDEST consumes from the producer side, which is only valid while producer and consumer share a thread
+/// (true for ESPHome components, where BLE events are dispatched from the main loop).
+inline size_t store_rx(ByteRing &ring, const uint8_t *data, size_t len, RxOverflowPolicy policy) {
+  if (policy == RxOverflowPolicy::DROP_OLDEST) {
+    size_t lost = 0;
+    if (len > ring.capacity()) {
+      // only the newest `capacity` bytes can survive
+      lost = len - ring.capacity();
+      data += lost;
+      len = ring.capacity();
+    }
+    const size_t free = ring.free();
+    if (free < len) {
+      ring.consume(len - free);
+      lost += len - free;
+    }
+    ring.write(data, len);
+    return lost;
+  }
+  return len - ring.write(data, len);
+}
+
+}  // namespace ble_nus_common
+}  // namespace esphome
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace ble_nus_common {
+
+/// Link health counters for one NUS transport. Every update is a single relaxed atomic operation, so the hot
+/// paths can record unconditionally; readers (sensor publishing, logging) only need eventually consistent values.
+class TransportStats {
+ public:
+  void on_tx_chunk(size_t len) {
+    this->bytes_sent_.fetch_add(len, std::memory_order_relaxed);
+    this->chunks_sent_.fetch_add(1, std::memory_order_relaxed);
+  }
+  void on_rx_chunk(size_t len) {
+    this->bytes_received_.fetch_add(len, std::memory_order_relaxed);
+    this->chunks_received_.fetch_add(1, std::memory_order_relaxed);
+  }
+  void on_dropped(size_t len) { this->dropped_bytes_.fetch_add(len, std::memory_order_relaxed); }
+  void on_write_failure() { this->write_failures_.fetch_add(1, std::memory_order_relaxed); }
+  /// `raw` uncompressed bytes travelled as `wire` bytes (both directions).
+  void on_compressed(size_t raw, size_t wire) {
+    this->compressed_raw_.fetch_add(raw, std::memory_order_relaxed);
+    this->compressed_wire_.fetch_add(wire, std::memory_order_relaxed);
+  }
+  void on_frame_error(size_t skipped) { this->frame_errors_.fetch_add(skipped, std::memory_order_relaxed); }
+  /// Call on every link establishment; the first one is not a reconnect.
+  void on_link_up() {
+    if (this->links_.fetch_add(1, std::memory_order_relaxed) > 0) {
+      this->reconnects_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  void track_rx_level(size_t level) { raise_(this->rx_high_water_, level); }
+  void track_tx_level(size_t level) { raise_(this->tx_high_water_, level); }
+
+  uint32_t bytes_sent() const { return this->bytes_sent_.load(std::memory_order_relaxed); }
+  uint32_t bytes_received() const { return this->bytes_received_.load(std::memory_order_relaxed); }
+  uint32_t chunks_sent() const { return this->chunks_sent_.load(std::memory_order_relaxed); }
+  uint32_t chunks_received() const { return this->chunks_received_.load(std::memory_order_relaxed); }
+  uint32_t dropped_bytes() const { return this->dropped_bytes_.load(std::memory_order_relaxed); }
+  uint32_t write_failures() const { return this->write_failures_.load(std::memory_order_relaxed); }
+  /// Uncompressed/wire size over all compressed chunks, 0 before the first one.
+  float compression_ratio() const {
+    const uint32_t wire = this->compressed_wire_.load(std::memory_order_relaxed);
+    return wire == 0 ? 0.0f : static_cast<float>(this->compressed_raw_.load(std::memory_order_relaxed)) / wire;
+  }
+  uint32_t frame_errors() const { return this->frame_errors_.load(std::memory_order_relaxed); }
+  uint32_t reconnects() const { return this->reconnects_.load(std::memory_order_relaxed); }
+  uint32_t rx_high_water() const { return this->rx_high_water_.load(std::memory_order_relaxed); }
+  uint32_t tx_high_water() const { return this->tx_high_water_.load(std::memory_order_relaxed); }
+
+ protected:
+  static void raise_(std::atomic<uint32_t> &mark, size_t level) {
+    uint32_t seen = mark.load(std::memory_order_relaxed);
+    while (level > seen && !mark.compare_exchange_weak(seen, level, std::memory_order_relaxed)) {
+    }
+  }
+
+  std::atomic<uint32_t> bytes_sent_{0};
+  std::atomic<uint32_t> bytes_received_{0};
+  std::atomic<uint32_t> chunks_sent_{0};
+  std::atomic<uint32_t> chunks_received_{0};
+  std::atomic<uint32_t> dropped_bytes_{0};
+  std::atomic<uint32_t> write_failures_{0};
+  std::atomic<uint32_t> frame_errors_{0};
+  std::atomic<uint32_t> compressed_raw_{0};
+  std::atomic<uint32_t> compressed_wire_{0};
+  std::atomic<uint32_t> links_{0};
+  std::atomic<uint32_t> reconnects_{0};
+  std::atomic<uint32_t> rx_high_water_{0};
+  std::atomic<uint32_t> tx_high_water_{0};
+};
+
+/// Turns a monotonically increasing byte counter into a rate over the interval between two samples.
+class ThroughputWindow {
+ public:
+  /// Returns bytes per second since the previous sample (0 on the first call).
+  float sample(uint32_t total_bytes, uint32_t now_ms) {
+    float rate = 0.0f;
+    if (this->primed_ && now_ms != this->last_ms_) {
+      rate = static_cast<float>(total_bytes - this->last_bytes_) * 1000.0f / static_cast<float>(now_ms - this->last_ms_);
+    }
+    this->primed_ = true;
+    this->last_bytes_ = total_bytes;
+    this->last_ms_ = now_ms;
+    return rate;
+  }
+
+ protected:
+  bool primed_{false};
+  uint32_t last_bytes_{0};
+  uint32_t last_ms_{0};
+};
+
+}  // namespace ble_nus_common
+}  // namespace esphome
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "byte_ring.h"
+#include "lz_codec.h"
+
+namespace esphome {
+namespace ble_nus_common {
+
+/// One ATT payload cut from a TX ring: `data`/`len` go on the air and carry `consumed` bytes of the ring.
+struct TxChunk {
+  const uint8_t *data;
+  size_t len;
+  size_t consumed;
+};
+
+/// Cuts the next payload of at most `max_payload` bytes from `ring`, starting `offset` bytes past its read
+/// position. Nothing is consumed; the caller does that once the stack has accepted the payload.
+///
+/// Without an encoder the payload points into the ring when it is contiguous, and is stitched into `staging`
+/// (`max_payload` bytes) when it wraps. With one, up to LZ_MAX_CHUNK_INPUT bytes are encoded into `staging`;
+/// `raw` (LZ_MAX_CHUNK_INPUT bytes) receives that input only when it wraps. Returns len 0 when nothing is pending.
+inline TxChunk next_tx_chunk(const ByteRing &ring, size_t offset, size_t max_payload, uint8_t *staging,
+                             LzEncoder *encoder, uint8_t *raw) {
+  const size_t available = ring.available();
+  const size_t pending = available > offset ? available - offset : 0;
+  if (pending == 0 || max_payload == 0) {
+    return {staging, 0, 0};
+  }
+  if (encoder == nullptr) {
+    const size_t len = std::min(pending, max_payload);
+    return {ring.peek_contiguous(len, staging, offset), len, len};
+  }
+  auto span = ring.readable(offset);
+  const uint8_t *in = span.data();
+  size_t in_len = std::min(pending, LZ_MAX_CHUNK_INPUT);
+  if (span.size() < in_len) {
+    in_len = ring.peek(raw, in_len, offset);
+    in = raw;
+  }
+  size_t consumed = 0;
+  const size_t len = encoder->encode_chunk(in, in_len, staging, max_payload, &consumed);
+  return {staging, len, consumed};
+}
+
+}  // namespace ble_nus_common
+}  // namespace esphome
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+
+namespace esphome {
+namespace ble_nus_common {
+
+/// Hysteresis between a high and a low fill level: reports a crossing above `high` once, and is re-armed only
+/// after the level falls back to `low` or below.
+class Watermark {
+ public:
+  enum Crossing { NONE, ROSE_ABOVE_HIGH, FELL_BELOW_LOW };
+
+  void configure(size_t high, size_t low) {
+    this->high_ = high;
+    this->low_ = low < high ? low : high;
+  }
+
+  Crossing update(size_t level) {
+    if (this->high_ == 0) {
+      return NONE;
+    }
+    if (!this->above_ && level >= this->high_) {
+      this->above_ = true;
+      return ROSE_ABOVE_HIGH;
+    }
+    if (this->above_ && level <= this->low_) {
+      this->above_ = false;
+      return FELL_BELOW_LOW;
+    }
+    return NONE;
+  }
+
+  /// Forgets a crossing, for when the buffer has been emptied behind its back.
+  void reset() { this->above_ = false; }
+
+  bool is_above() const { return this->above_; }
+  size_t high() const { return this->high_; }
+  size_t low() const { return this->low_; }
+
+ protected:
+  size_t high_{0};
+  size_t low_{0};
+  bool above_{false};
+};
+
+}  // namespace ble_nus_common
+}  // namespace esphome
@@ -0,0 +1,36 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.const import CONF_ID
+
+CODEOWNERS = ["@latonita"]
+MULTI_CONF = True
+AUTO_LOAD = ["ble_nus_common"]
+
+CONF_MAX_CONNECTIONS = "max_connections"
+CONF_SESSION_TIMEOUT = "session_timeout"
+CONF_DRAIN_TIME = "drain_time"
+CONF_SWEEP_INTERVAL = "sweep_interval"
+
+ble_nus_scheduler_ns = cg.esphome_ns.namespace("ble_nus_scheduler")
+BLENUSScheduler = ble_nus_scheduler_ns.class_("BLENUSScheduler", cg.Component)
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.declare_id(BLENUSScheduler),
+        cv.Optional(CONF_MAX_CONNECTIONS, default=1): cv.int_range(min=1, max=9),
+        cv.Optional(CONF_SESSION_TIMEOUT, default="30s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_DRAIN_TIME, default="1s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_SWEEP_INTERVAL): cv.positive_not_null_time_period,
+    }
+).extend(cv.COMPONENT_SCHEMA)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+
+    cg.add(var.set_max_connections(config[CONF_MAX_CONNECTIONS]))
+    cg.add(var.set_session_timeout(config[CONF_SESSION_TIMEOUT]))
+    cg.add(var.set_drain_time(config[CONF_DRAIN_TIME]))
+    if CONF_SWEEP_INTERVAL in config:
+        cg.add(var.set_sweep_interval(config[CONF_SWEEP_INTERVAL].total_milliseconds))
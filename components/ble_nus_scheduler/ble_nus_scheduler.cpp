@@ -0,0 +1,167 @@
+#include "ble_nus_scheduler.h"
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+
+namespace esphome {
+namespace ble_nus_scheduler {
+
+static const char *const TAG = "ble_nus_scheduler";
+
+void BLENUSScheduler::setup() {
+  if (this->sweep_interval_ms_ > 0) {
+    this->set_interval("sweep", this->sweep_interval_ms_, [this]() { this->sweep(); });
+  }
+}
+
+void BLENUSScheduler::dump_config() {
+  ESP_LOGCONFIG(TAG, "BLE NUS Scheduler");
+  ESP_LOGCONFIG(TAG, "  Links: %zu, max concurrent connections: %u", this->links_.size(), this->max_connections_);
+  ESP_LOGCONFIG(TAG, "  Session timeout: %u ms, drain time: %u ms", this->session_timeout_ms_, this->drain_time_ms_);
+  if (this->sweep_interval_ms_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Sweep interval: %u ms", this->sweep_interval_ms_);
+  }
+}
+
+void BLENUSScheduler::register_link(ble_nus_common::ScheduledLink *link, uint32_t session_timeout_ms) {
+  if (this->find_(link) != nullptr) {
+    return;
+  }
+  this->links_.push_back({link, session_timeout_ms > 0 ? session_timeout_ms : this->session_timeout_ms_, false,
+                          false, false, false, 0, 0});
+}
+
+void BLENUSScheduler::request(ble_nus_common::ScheduledLink *link) {
+  Entry *entry = this->find_(link);
+  if (entry == nullptr || entry->queued || entry->active) {
+    return;
+  }
+  entry->queued = true;
+  this->queue_.push_back(entry - this->links_.data());
+  ESP_LOGV(TAG, "Link #%zu queued (%zu waiting)", this->queue_.back(), this->queue_.size());
+  // granted from loop(), which also starts watching the drain of links that may have to yield
+  this->enable_loop();
+}
+
+void BLENUSScheduler::release(ble_nus_common::ScheduledLink *link) {
+  Entry *entry = this->find_(link);
+  if (entry == nullptr) {
+    return;
+  }
+  const size_t index = entry - this->links_.data();
+  if (entry->queued) {
+    this->queue_.erase(std::remove(this->queue_.begin(), this->queue_.end(), index), this->queue_.end());
+    entry->queued = false;
+  }
+  if (entry->active) {
+    entry->active = false;
+    this->active_count_--;
+    ESP_LOGD(TAG, "Link #%zu released its slot after %u ms", index, millis() - entry->granted_ms);
+    // the freed slot may go to a waiting link
+    this->enable_loop();
+  }
+  entry->swept = false;
+}
+
+void BLENUSScheduler::sweep() {
+  for (auto &entry : this->links_) {
+    if (!entry.queued && !entry.active) {
+      entry.swept = true;
+      this->request(entry.link);
+    }
+  }
+  this->enable_loop();
+}
+
+void BLENUSScheduler::loop() {
+  const uint32_t now = millis();
+  for (size_t i = 0; i < this->links_.size(); i++) {
+    Entry &entry = this->links_[i];
+    if (!entry.active || entry.revoked) {
+      continue;
+    }
+    if (entry.session_timeout_ms > 0 && now - entry.granted_ms >= entry.session_timeout_ms) {
+      this->revoke_(i, "session deadline");
+      continue;
+    }
+    if (!entry.link->is_link_drained()) {
+      entry.drained_since_ms = 0;
+      continue;
+    }
+    if (entry.drained_since_ms == 0) {
+      entry.drained_since_ms = now;
+    } else if (now - entry.drained_since_ms >= this->drain_time_ms_ && (entry.swept || !this->queue_.empty())) {
+      this->revoke_(i, "drained");
+    }
+  }
+
+  while (this->active_count_ < this->max_connections_ && !this->queue_.empty()) {
+    const size_t index = this->queue_.front();
+    this->queue_.pop_front();
+    Entry &entry = this->links_[index];
+    entry.queued = false;
+    entry.active = true;
+    entry.revoked = false;
+    entry.granted_ms = now;
+    entry.drained_since_ms = 0;
+    this->active_count_++;
+    ESP_LOGD(TAG, "Link #%zu granted a slot (%u/%u in use)", index, this->active_count_, this->max_connections_);
+    entry.link->on_slot_granted();
+  }
+  this->sleep_until_needed_();
+}
+
+void BLENUSScheduler::sleep_until_needed_() {
+  // request(), release() and sweep() re-enable the loop; otherwise it only has deadlines to watch
+  const uint32_t now = millis();
+  uint32_t wait = UINT32_MAX;
+  auto until = [now, &wait](uint32_t deadline) {
+    const int32_t left = static_cast<int32_t>(deadline - now);
+    wait = std::min<uint32_t>(wait, left > 0 ? left : 0);
+  };
+  for (const auto &entry : this->links_) {
+    if (!entry.active || entry.revoked) {
+      continue;
+    }
+    if (entry.session_timeout_ms > 0) {
+      until(entry.granted_ms + entry.session_timeout_ms);
+    }
+    if (!entry.swept && this->queue_.empty()) {
+      // nobody waits for this slot, so its drain does not matter
+      continue;
+    }
+    // links report no drain event, and the drain must hold for the whole drain time: sample it
+    if (entry.drained_since_ms != 0) {
+      until(entry.drained_since_ms + this->drain_time_ms_);
+    }
+    until(now + std::min(DRAIN_POLL_MS, this->drain_time_ms_));
+  }
+  if (wait == 0) {
+    return;
+  }
+  this->disable_loop();
+  if (wait != UINT32_MAX) {
+    this->set_timeout("wake", wait, [this]() { this->enable_loop(); });
+  }
+}
+
+BLENUSScheduler::Entry *BLENUSScheduler::find_(ble_nus_common::ScheduledLink *link) {
+  for (auto &entry : this->links_) {
+    if (entry.link == link) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+void BLENUSScheduler::revoke_(size_t index, const char *reason) {
+  Entry &entry = this->links_[index];
+  entry.revoked = true;
+  ESP_LOGD(TAG, "Link #%zu: %s, taking its slot back", index, reason);
+  entry.link->on_slot_revoked();
+}
+
+}  // namespace ble_nus_scheduler
+}  // namespace esphome
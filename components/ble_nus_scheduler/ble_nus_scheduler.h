@@ -0,0 +1,68 @@
+#pragma once
+
+#include "esphome/core/component.h"
+#include "esphome/components/ble_nus_common/link_scheduler.h"
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace esphome {
+namespace ble_nus_scheduler {
+
+/// Shares a limited number of concurrent BLE connections between several NUS clients.
+///
+/// Requests are served first come, first served. A granted link keeps its slot until it disconnects, until its
+/// session deadline passes, or until it has been drained for `drain_time` while other links wait. With a sweep
+/// interval, every link is queued periodically and let go as soon as it is drained: connect, drain, disconnect,
+/// next.
+class BLENUSScheduler : public Component, public ble_nus_common::LinkScheduler {
+ public:
+  void setup() override;
+  void loop() override;
+  void dump_config() override;
+  float get_setup_priority() const override { return setup_priority::AFTER_BLUETOOTH; }
+
+  void set_max_connections(uint8_t max_connections) { this->max_connections_ = max_connections; }
+  void set_session_timeout(uint32_t timeout_ms) { this->session_timeout_ms_ = timeout_ms; }
+  void set_drain_time(uint32_t drain_ms) { this->drain_time_ms_ = drain_ms; }
+  void set_sweep_interval(uint32_t interval_ms) { this->sweep_interval_ms_ = interval_ms; }
+
+  /// `session_timeout_ms == 0` uses the scheduler-wide session timeout.
+  void register_link(ble_nus_common::ScheduledLink *link, uint32_t session_timeout_ms) override;
+  void request(ble_nus_common::ScheduledLink *link) override;
+  void release(ble_nus_common::ScheduledLink *link) override;
+  /// Queues every registered link that is neither queued nor connected.
+  void sweep();
+
+ protected:
+  struct Entry {
+    ble_nus_common::ScheduledLink *link;
+    uint32_t session_timeout_ms;
+    bool queued;
+    bool active;
+    bool revoked;
+    bool swept;
+    uint32_t granted_ms;
+    uint32_t drained_since_ms;
+  };
+
+  Entry *find_(ble_nus_common::ScheduledLink *link);
+  void revoke_(size_t index, const char *reason);
+  void sleep_until_needed_();
+
+  // how often the drain of a link that may have to yield is sampled; its drain timer has this resolution
+  static constexpr uint32_t DRAIN_POLL_MS = 100;
+
+  uint8_t max_connections_{1};
+  uint32_t session_timeout_ms_{30000};
+  uint32_t drain_time_ms_{1000};
+  uint32_t sweep_interval_ms_{0};
+
+  std::vector<Entry> links_;
+  std::deque<size_t> queue_;
+  uint8_t active_count_{0};
+};
+
+}  // namespace ble_nus_scheduler
+}  // namespace esphome
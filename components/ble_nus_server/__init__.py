@@ -14,22 +14,60 @@ CONF_ON_CONNECTED = "on_connected"
 CONF_ON_DISCONNECTED = "on_disconnected"
 CONF_ON_SENT = "on_sent"
 CONF_ON_DATA = "on_data"
+CONF_ON_FLUSH_COMPLETE = "on_flush_complete"
+CONF_FLUSH_TIMEOUT = "flush_timeout"
+CONF_RX_BUFFER_SIZE = "rx_buffer_size"
+CONF_TX_BUFFER_SIZE = "tx_buffer_size"
+CONF_BUFFERS_IN_PSRAM = "buffers_in_psram"
+CONF_HIGH_WATERMARK = "high_watermark"
+CONF_LOW_WATERMARK = "low_watermark"
+CONF_RX_OVERFLOW_POLICY = "rx_overflow_policy"
+CONF_ON_RX_HIGH_WATERMARK = "on_rx_high_watermark"
+CONF_ON_FRAME = "on_frame"
+CONF_ON_MESSAGE = "on_message"
+CONF_MESSAGE = "message"
+CONF_IDLE_GAP = "idle_gap"
+CONF_MAX_SIZE = "max_size"
+CONF_MAX_LATENCY = "max_latency"
+CONF_DELIMITER = "delimiter"
+CONF_FRAMING = "framing"
+CONF_COMPRESSION = "compression"
+CONF_MAX_FRAME_SIZE = "max_frame_size"
+CONF_LINKS = "links"
+CONF_BROADCAST = "broadcast"
+CONF_CONNECTION_PROFILES = "connection_profiles"
+CONF_BULK = "bulk"
+CONF_IDLE = "idle"
+CONF_IDLE_DELAY = "idle_delay"
+CONF_MIN_INTERVAL = "min_interval"
+CONF_MAX_INTERVAL = "max_interval"
+CONF_LATENCY = "latency"
+CONF_TIMEOUT = "timeout"
 
 START_ADVERTISING_ACTION = "ble_nus_server.start_advertising"
 STOP_ADVERTISING_ACTION = "ble_nus_server.stop_advertising"
 DISCONNECT_ACTION = "ble_nus_server.disconnect"
 
 DEPENDENCIES = ["esp32_ble", "esp32_ble_server", "uart"]
-AUTO_LOAD = ["uart", "esp32_ble"]
+AUTO_LOAD = ["uart", "esp32_ble", "ble_nus_common"]
 
 ble_nus_server_ns = cg.esphome_ns.namespace("ble_nus_server")
 BLENUSServerComponent = ble_nus_server_ns.class_(
     "BLENUSServerComponent", uart.UARTComponent, cg.Component
 )
+BLENUSServerLink = ble_nus_server_ns.class_("BLENUSServerLink", uart.UARTComponent)
 StartAdvertisingAction = ble_nus_server_ns.class_("StartAdvertisingAction", automation.Action)
 StopAdvertisingAction = ble_nus_server_ns.class_("StopAdvertisingAction", automation.Action)
 DisconnectAction = ble_nus_server_ns.class_("DisconnectAction", automation.Action)
 
+ble_nus_common_ns = cg.esphome_ns.namespace("ble_nus_common")
+RxOverflowPolicy = ble_nus_common_ns.enum("RxOverflowPolicy", True)
+RX_OVERFLOW_POLICIES = {
+    "drop_newest": RxOverflowPolicy.DROP_NEWEST,
+    "drop_oldest": RxOverflowPolicy.DROP_OLDEST,
+    "pause": RxOverflowPolicy.PAUSE,
+}
+
 
 def _uuid_128(value):
     value = cv.string_strict(value)
@@ -38,24 +76,148 @@ def _uuid_128(value):
     return value.upper()
 
 
-CONFIG_SCHEMA = cv.Schema(
+def _validate_conn_params(config):
+    if config[CONF_MIN_INTERVAL] > config[CONF_MAX_INTERVAL]:
+        raise cv.Invalid(f"{CONF_MIN_INTERVAL} must not be greater than {CONF_MAX_INTERVAL}")
+    return config
+
+
+def _conn_params_schema(min_interval, max_interval, latency, timeout):
+    interval = cv.All(
+        cv.positive_time_period_microseconds,
+        cv.Range(min=cv.TimePeriod(microseconds=7500), max=cv.TimePeriod(seconds=4)),
+    )
+    return cv.All(
+        cv.Schema(
+            {
+                cv.Optional(CONF_MIN_INTERVAL, default=min_interval): interval,
+                cv.Optional(CONF_MAX_INTERVAL, default=max_interval): interval,
+                cv.Optional(CONF_LATENCY, default=latency): cv.int_range(min=0, max=499),
+                cv.Optional(CONF_TIMEOUT, default=timeout): cv.All(
+                    cv.positive_time_period_milliseconds,
+                    cv.Range(min=cv.TimePeriod(milliseconds=100), max=cv.TimePeriod(seconds=32)),
+                ),
+            }
+        ),
+        _validate_conn_params,
+    )
+
+
+def _conn_params_args(config):
+    # controller units: 1.25 ms for intervals, 10 ms for the supervision timeout
+    return (
+        config[CONF_MIN_INTERVAL].total_microseconds // 1250,
+        config[CONF_MAX_INTERVAL].total_microseconds // 1250,
+        config[CONF_LATENCY],
+        config[CONF_TIMEOUT].total_milliseconds // 10,
+    )
+
+
+CONNECTION_PROFILES_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_BULK, default={}): _conn_params_schema("7.5ms", "15ms", 0, "2s"),
+        cv.Optional(CONF_IDLE, default={}): _conn_params_schema("100ms", "200ms", 4, "6s"),
+        cv.Optional(CONF_IDLE_DELAY, default="3s"): cv.positive_time_period_milliseconds,
+    }
+)
+
+
+FRAMING_SCHEMA = cv.Schema(
+    {
+        # clamped at runtime to what the RX buffer can hold
+        cv.Optional(CONF_MAX_FRAME_SIZE, default=65535): cv.int_range(min=1, max=65535),
+    }
+)
+
+
+def _validate_framing(config):
+    if CONF_ON_FRAME in config and CONF_FRAMING not in config:
+        raise cv.Invalid(f"{CONF_ON_FRAME} requires {CONF_FRAMING}")
+    return config
+
+
+def _delimiter(value):
+    if isinstance(value, str):
+        value = [ord(c) for c in value]
+    value = cv.ensure_list(cv.hex_uint8_t)(value)
+    if not 1 <= len(value) <= 8:
+        raise cv.Invalid(f"{CONF_DELIMITER} must be 1 to 8 bytes")
+    return value
+
+
+MESSAGE_SCHEMA = cv.Schema(
     {
-        cv.GenerateID(): cv.declare_id(BLENUSServerComponent),
-        cv.Required(CONF_PIN): cv.int_range(min=0, max=999999),
-        cv.Optional(CONF_SERVICE_UUID, default="6E400001-B5A3-F393-E0A9-E50E24DCCA9E"): _uuid_128,
-        cv.Optional(CONF_RX_UUID, default="6E400002-B5A3-F393-E0A9-E50E24DCCA9E"): _uuid_128,
-        cv.Optional(CONF_TX_UUID, default="6E400003-B5A3-F393-E0A9-E50E24DCCA9E"): _uuid_128,
-        cv.Optional(CONF_MTU, default=247): cv.int_range(min=23, max=517),
-        cv.Optional(CONF_IDLE_TIMEOUT, default="0s"): cv.positive_time_period_milliseconds,
-        cv.Optional(CONF_AUTOCONNECT, default=True): cv.boolean,
-        cv.Optional(CONF_ON_CONNECTED): automation.validate_automation(),
-        cv.Optional(CONF_ON_DISCONNECTED): automation.validate_automation(),
-        cv.Optional(CONF_ON_SENT): automation.validate_automation(),
-        cv.Optional(CONF_ON_DATA): automation.validate_automation(),
+        # 0s disables a bound; a message always ends at max_size, clamped at runtime to the RX buffer
+        cv.Optional(CONF_IDLE_GAP, default="20ms"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_MAX_SIZE, default=256): cv.int_range(min=1, max=65536),
+        cv.Optional(CONF_MAX_LATENCY, default="0s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_DELIMITER): _delimiter,
     }
 )
 
 
+def _validate_messages(config):
+    if CONF_MESSAGE in config and CONF_ON_MESSAGE not in config:
+        raise cv.Invalid(f"{CONF_MESSAGE} requires {CONF_ON_MESSAGE}")
+    # both consume the RX stream, so only one of them can own it
+    if CONF_ON_MESSAGE in config and CONF_ON_FRAME in config:
+        raise cv.Invalid(f"{CONF_ON_MESSAGE} and {CONF_ON_FRAME} cannot be used together")
+    return config
+
+
+def _validate_watermarks(config):
+    # pausing needs a high watermark to trigger on
+    if config[CONF_RX_OVERFLOW_POLICY] == "pause" and CONF_HIGH_WATERMARK not in config:
+        config[CONF_HIGH_WATERMARK] = 0.75
+    if CONF_HIGH_WATERMARK in config and config[CONF_LOW_WATERMARK] >= config[CONF_HIGH_WATERMARK]:
+        raise cv.Invalid(f"{CONF_LOW_WATERMARK} must be below {CONF_HIGH_WATERMARK}")
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(BLENUSServerComponent),
+            cv.Required(CONF_PIN): cv.int_range(min=0, max=999999),
+            cv.Optional(CONF_SERVICE_UUID, default="6E400001-B5A3-F393-E0A9-E50E24DCCA9E"): _uuid_128,
+            cv.Optional(CONF_RX_UUID, default="6E400002-B5A3-F393-E0A9-E50E24DCCA9E"): _uuid_128,
+            cv.Optional(CONF_TX_UUID, default="6E400003-B5A3-F393-E0A9-E50E24DCCA9E"): _uuid_128,
+            cv.Optional(CONF_MTU, default=247): cv.int_range(min=23, max=517),
+            cv.Optional(CONF_IDLE_TIMEOUT, default="0s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_FLUSH_TIMEOUT, default="2s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_RX_BUFFER_SIZE, default=512): cv.int_range(min=64, max=65536),
+            cv.Optional(CONF_TX_BUFFER_SIZE, default=512): cv.int_range(min=64, max=65536),
+            cv.Optional(CONF_BUFFERS_IN_PSRAM, default=False): cv.boolean,
+            cv.Optional(CONF_HIGH_WATERMARK): cv.percentage,
+            cv.Optional(CONF_LOW_WATERMARK, default="25%"): cv.percentage,
+            cv.Optional(CONF_FRAMING): FRAMING_SCHEMA,
+            cv.Optional(CONF_MESSAGE): MESSAGE_SCHEMA,
+            cv.Optional(CONF_COMPRESSION, default=False): cv.boolean,
+            cv.Optional(CONF_RX_OVERFLOW_POLICY, default="drop_newest"): cv.enum(RX_OVERFLOW_POLICIES, lower=True),
+            cv.Optional(CONF_AUTOCONNECT, default=True): cv.boolean,
+            # the server's own UART serves the first central, each entry one more
+            cv.Optional(CONF_LINKS, default=[]): cv.All(
+                cv.ensure_list(cv.Schema({cv.GenerateID(): cv.declare_id(BLENUSServerLink)})),
+                cv.Length(max=8),
+            ),
+            cv.Optional(CONF_BROADCAST, default=False): cv.boolean,
+            cv.Optional(CONF_CONNECTION_PROFILES): CONNECTION_PROFILES_SCHEMA,
+            cv.Optional(CONF_ON_CONNECTED): automation.validate_automation(),
+            cv.Optional(CONF_ON_DISCONNECTED): automation.validate_automation(),
+            cv.Optional(CONF_ON_SENT): automation.validate_automation(),
+            cv.Optional(CONF_ON_DATA): automation.validate_automation(),
+            cv.Optional(CONF_ON_FLUSH_COMPLETE): automation.validate_automation(),
+            cv.Optional(CONF_ON_RX_HIGH_WATERMARK): automation.validate_automation(),
+            cv.Optional(CONF_ON_FRAME): automation.validate_automation(),
+            cv.Optional(CONF_ON_MESSAGE): automation.validate_automation(),
+        }
+    ),
+    _validate_watermarks,
+    _validate_framing,
+    _validate_messages,
+)
+
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
@@ -66,7 +228,31 @@ async def to_code(config):
     cg.add(var.set_passkey(config[CONF_PIN]))
     cg.add(var.set_mtu(config[CONF_MTU]))
     cg.add(var.set_idle_disconnect_timeout(config[CONF_IDLE_TIMEOUT]))
+    cg.add(var.set_flush_timeout(config[CONF_FLUSH_TIMEOUT]))
+    cg.add(var.set_rx_buffer_size(config[CONF_RX_BUFFER_SIZE]))
+    cg.add(var.set_tx_buffer_size(config[CONF_TX_BUFFER_SIZE]))
+    cg.add(var.set_buffers_in_psram(config[CONF_BUFFERS_IN_PSRAM]))
+    cg.add(var.set_rx_overflow_policy(config[CONF_RX_OVERFLOW_POLICY]))
+    cg.add(var.set_compression(config[CONF_COMPRESSION]))
+    if CONF_FRAMING in config:
+        cg.add(var.set_framing(config[CONF_FRAMING][CONF_MAX_FRAME_SIZE]))
+    if CONF_HIGH_WATERMARK in config:
+        cg.add(
+            var.set_watermarks(
+                int(round(config[CONF_HIGH_WATERMARK] * 100)),
+                int(round(config[CONF_LOW_WATERMARK] * 100)),
+            )
+        )
     cg.add(var.set_autoadvertise(config[CONF_AUTOCONNECT]))
+    cg.add(var.set_broadcast(config[CONF_BROADCAST]))
+    if CONF_CONNECTION_PROFILES in config:
+        profiles = config[CONF_CONNECTION_PROFILES]
+        cg.add(var.set_bulk_conn_params(*_conn_params_args(profiles[CONF_BULK])))
+        cg.add(var.set_idle_conn_params(*_conn_params_args(profiles[CONF_IDLE])))
+        cg.add(var.set_conn_profile_idle_delay(profiles[CONF_IDLE_DELAY]))
+    for conf in config[CONF_LINKS]:
+        link = cg.new_Pvariable(conf[CONF_ID])
+        cg.add(var.add_link(link))
 
     if CONF_ON_CONNECTED in config:
         for conf in config[CONF_ON_CONNECTED]:
@@ -84,6 +270,36 @@ async def to_code(config):
         for conf in config[CONF_ON_DATA]:
             await automation.build_automation(var.get_on_data_trigger(), [], conf)
 
+    if CONF_ON_FLUSH_COMPLETE in config:
+        for conf in config[CONF_ON_FLUSH_COMPLETE]:
+            await automation.build_automation(var.get_on_flush_complete_trigger(), [(cg.bool_, "success")], conf)
+
+    if CONF_ON_RX_HIGH_WATERMARK in config:
+        for conf in config[CONF_ON_RX_HIGH_WATERMARK]:
+            await automation.build_automation(var.get_on_rx_high_watermark_trigger(), [], conf)
+
+    if CONF_ON_FRAME in config:
+        cg.add(var.set_frame_dispatch(True))
+        for conf in config[CONF_ON_FRAME]:
+            await automation.build_automation(
+                var.get_on_frame_trigger(), [(cg.std_vector.template(cg.uint8), "frame")], conf
+            )
+
+    if CONF_ON_MESSAGE in config:
+        message = config.get(CONF_MESSAGE, MESSAGE_SCHEMA({}))
+        cg.add(
+            var.set_message_dispatch(
+                message[CONF_IDLE_GAP],
+                message[CONF_MAX_SIZE],
+                message[CONF_MAX_LATENCY],
+                message.get(CONF_DELIMITER, []),
+            )
+        )
+        for conf in config[CONF_ON_MESSAGE]:
+            await automation.build_automation(
+                var.get_on_message_trigger(), [(cg.std_vector.template(cg.uint8), "data")], conf
+            )
+
 
 @automation.register_action(START_ADVERTISING_ACTION, StartAdvertisingAction, cv.Schema({cv.GenerateID(): cv.use_id(BLENUSServerComponent)}))
 async def start_adv_action_to_code(config, action_id, template_arg, args):
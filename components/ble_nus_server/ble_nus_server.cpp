@@ -1,97 +1,318 @@
 #include "ble_nus_server.h"
 
 #include "esphome/core/log.h"
+#include "esphome/components/ble_nus_common/blocking_flush.h"
+#include "esphome/components/ble_nus_common/ring_factory.h"
+#include "esphome/components/ble_nus_common/tx_chunker.h"
+
+#include <esp_gap_ble_api.h>
+#include <esp_gatt_common_api.h>
+#include <esp_gatts_api.h>
+
+#include <cmath>
+#include <cstring>
 
 namespace esphome {
 namespace ble_nus_server {
 
 static const char *const TAG = "ble_nus_server";
 
-void BLENUSServerComponent::setup() {
-  this->rx_buffer_ = esphome::RingBuffer::create(RX_BUFFER_CAPACITY);
-  this->tx_buffer_ = esphome::RingBuffer::create(TX_BUFFER_CAPACITY);
-  this->peek_valid_ = false;
-  this->init_gatt_();
-  if (this->auto_advertise_) {
-    this->start_advertising();
+bool BLENUSServerLink::setup_(BLENUSServerComponent *parent, uint8_t index) {
+  this->parent_ = parent;
+  this->index_ = index;
+  this->rx_buffer_ = ble_nus_common::create_byte_ring(parent->rx_buffer_size_, parent->buffers_in_psram_);
+  if (this->rx_buffer_ == nullptr) {
+    return false;
+  }
+  // the server's own link writes into the shared broadcast ring instead
+  if (!(parent->broadcast_ && this == &parent->primary_)) {
+    this->tx_buffer_ = ble_nus_common::create_byte_ring(parent->tx_buffer_size_, parent->buffers_in_psram_);
+    if (this->tx_buffer_ == nullptr) {
+      return false;
+    }
+  }
+  if (parent->high_watermark_pct_ > 0) {
+    this->rx_watermark_.configure(parent->rx_buffer_size_ * parent->high_watermark_pct_ / 100,
+                                  parent->rx_buffer_size_ * parent->low_watermark_pct_ / 100);
+    this->tx_watermark_.configure(parent->tx_buffer_size_ * parent->high_watermark_pct_ / 100,
+                                  parent->tx_buffer_size_ * parent->low_watermark_pct_ / 100);
   }
+  this->rx_messages_ = parent->rx_messages_;
+  this->rx_messages_.clamp_max_size(parent->rx_buffer_size_);
+  return true;
 }
 
-void BLENUSServerComponent::loop() {
-  this->handle_idle_();
-  this->publish_notifications_();
+void BLENUSServerLink::loop_() {
+  if (this->connected_ && this->parent_->idle_disconnect_timeout_ms_ > 0 &&
+      millis() - this->last_activity_ms_ > this->parent_->idle_disconnect_timeout_ms_) {
+    ESP_LOGI(TAG, "Central #%u idle timeout reached, disconnecting", this->index_);
+    this->disconnect();
+  }
+  this->pump_();
+  this->retry_rx_pause_();
+  this->update_conn_profile_();
+  this->check_flush_();
+  if (this->parent_->message_dispatch_) {
+    this->dispatch_messages_();
+  }
 }
 
-void BLENUSServerComponent::dump_config() { ESP_LOGCONFIG(TAG, "UART Nordic Server (BLE NUS)"); }
+uint32_t BLENUSServerLink::loop_wait_(uint32_t now) {
+  // how long loop_() can go without running: 0 if it has work now, UINT32_MAX if only an event can give it some
+  uint32_t wait = UINT32_MAX;
+  auto until = [now, &wait](uint32_t deadline) {
+    const int32_t left = static_cast<int32_t>(deadline - now);
+    wait = std::min<uint32_t>(wait, left > 0 ? left : 0);
+  };
+  if (this->connected_) {
+    if (this->parent_->idle_disconnect_timeout_ms_ > 0) {
+      until(this->last_activity_ms_ + this->parent_->idle_disconnect_timeout_ms_ + 1);
+    }
+    // a notification that failed to go out is retried from loop_(); in-flight ones wake it through CONF_EVT
+    if (this->notifications_enabled_ && !this->tx_congested_ && this->tx_in_flight_ == 0 &&
+        this->tx_backlog_() > 0) {
+      return 0;
+    }
+    if (this->rx_pause_retry_) {
+      until(this->rx_pause_failed_ms_ + BLENUSServerComponent::RX_PAUSE_RETRY_MS);
+    }
+    if (this->parent_->conn_profiles_enabled_ && !this->rx_paused_) {
+      if (this->conn_params_pending_) {
+        until(this->conn_params_request_ms_ + BLENUSServerComponent::CONN_PROFILE_RETRY_MS);
+      } else if (this->conn_profile_ == ConnProfile::BULK && !this->data_queued_()) {
+        until(this->last_activity_ms_ + this->parent_->conn_profile_idle_delay_ms_);
+      }
+    }
+  }
+  if (this->flush_pending_) {
+    until(this->flush_started_ms_ + this->parent_->tx_flush_timeout_ms_ + 1);
+  }
+  uint32_t message_deadline;
+  if (this->parent_->message_dispatch_ && this->rx_messages_.next_deadline(&message_deadline)) {
+    until(message_deadline);
+  }
+  return wait;
+}
 
-void BLENUSServerComponent::handle_idle_() {
-  if (!this->connected_ || this->idle_disconnect_timeout_ms_ == 0) {
-    return;
+void BLENUSServerLink::on_connect_(uint16_t conn_id, const esp_bd_addr_t bda) {
+  this->connected_ = true;
+  this->conn_id_ = conn_id;
+  memcpy(this->remote_bda_, bda, sizeof(esp_bd_addr_t));
+  // nothing is notified until the central subscribes through the CCCD, and chunks stay at 20 bytes until it
+  // exchanges a larger MTU
+  this->notifications_enabled_ = false;
+  this->mtu_ = 23;
+  this->conn_profile_ = ConnProfile::NONE;
+  this->conn_params_pending_ = false;
+  this->compression_active_ = false;
+  this->broadcast_offset_ = 0;
+  this->sending_broadcast_ = false;
+  this->last_activity_ms_ = millis();
+}
+
+void BLENUSServerLink::on_disconnect_() {
+  this->connected_ = false;
+  this->notifications_enabled_ = false;
+  this->rx_paused_ = false;
+  this->rx_pause_retry_ = false;
+  this->tx_in_flight_ = 0;
+  this->tx_congested_ = false;
+  this->conn_interval_ = 0;
+  this->conn_profile_ = ConnProfile::NONE;
+  this->broadcast_offset_ = 0;
+  this->sending_broadcast_ = false;
+  // the slot goes to the next central that connects, which must not inherit this one's stream; the shared
+  // broadcast ring stays, only this link's position in it is dropped
+  this->rx_buffer_->reset();
+  if (this->tx_buffer_ != nullptr) {
+    this->tx_buffer_->reset();
   }
-  if (millis() - this->last_activity_ms_ > this->idle_disconnect_timeout_ms_) {
-    ESP_LOGI(TAG, "Idle timeout reached, disconnecting");
-    this->disconnect();
+  this->rx_messages_.reset();
+  this->rx_watermark_.reset();
+  this->tx_watermark_.reset();
+  if (this->flush_pending_) {
+    this->complete_flush_(false);
   }
 }
 
-void BLENUSServerComponent::publish_notifications_() {
-  if (!this->connected_ || !this->notifications_enabled_ || this->tx_buffer_ == nullptr || this->chr_tx_handle_ == 0) {
+void BLENUSServerLink::disconnect() {
+  if (!this->connected_ || this->parent_->server_ == nullptr) {
     return;
   }
-  if (this->tx_in_progress_) {
-    return;
+  ESP_LOGI(TAG, "Disconnecting central #%u (conn_id=%u)", this->index_, this->conn_id_);
+  esp_ble_gatts_close(this->parent_->server_->get_gatts_if(), this->conn_id_);
+}
+
+ble_nus_common::ByteRing *BLENUSServerLink::tx_target_() const {
+  return this->tx_buffer_ != nullptr ? this->tx_buffer_.get() : this->parent_->broadcast_buffer_.get();
+}
+
+ble_nus_common::ByteRing *BLENUSServerLink::tx_source_(size_t *offset) {
+  ble_nus_common::ByteRing *broadcast = this->parent_->broadcast_buffer_.get();
+  const bool unicast_pending = this->tx_buffer_ != nullptr && !this->tx_buffer_->empty();
+  const bool broadcast_pending = broadcast != nullptr && broadcast->available() > this->broadcast_offset_;
+  if (this->sending_broadcast_ && !broadcast_pending) {
+    this->sending_broadcast_ = false;
+  } else if (!this->sending_broadcast_ && !unicast_pending && broadcast_pending) {
+    this->sending_broadcast_ = true;
   }
-  size_t pending = this->tx_buffer_->available();
-  if (pending == 0) {
-    return;
+  if (this->sending_broadcast_) {
+    *offset = this->broadcast_offset_;
+    return broadcast;
   }
+  *offset = 0;
+  return unicast_pending ? this->tx_buffer_.get() : nullptr;
+}
 
-  size_t max_payload = this->mtu_ > 3 ? (this->mtu_ - 3) : 20;
-  std::vector<uint8_t> chunk(std::min(pending, max_payload));
-  size_t pulled = this->tx_buffer_->read(chunk.data(), chunk.size(), 0);
-  if (pulled == 0) {
+void BLENUSServerLink::pump_() {
+  if (!this->connected_ || !this->notifications_enabled_ || this->tx_congested_) {
     return;
   }
+  // as many notifications as the controller has buffers for, so several can leave in one connection event
+  const uint16_t sendable = esp_ble_get_cur_sendable_packets_num(this->conn_id_);
+  size_t budget = sendable > this->tx_in_flight_ ? sendable - this->tx_in_flight_ : 0;
+  if (budget == 0 && this->tx_in_flight_ == 0) {
+    budget = 1;  // the count may not be reported at all; never stall an idle link
+  }
+  auto &staging = this->parent_->tx_chunk_;
+  const size_t max_payload = std::min<size_t>(this->mtu_ > 3 ? (this->mtu_ - 3) : 20, staging.size());
+  for (; budget > 0; budget--) {
+    size_t offset = 0;
+    ble_nus_common::ByteRing *source = this->tx_source_(&offset);
+    if (source == nullptr) {
+      break;
+    }
+    const ble_nus_common::TxChunk next =
+        ble_nus_common::next_tx_chunk(*source, offset, max_payload, staging.data(),
+                                      this->compression_active_ ? &this->tx_encoder_ : nullptr,
+                                      this->parent_->tx_raw_.data());
+    const uint8_t *chunk = next.data;
+    const size_t len = next.len;
+    const size_t consumed = next.consumed;
+    if (len == 0) {
+      break;
+    }
+    if (!this->send_notification_(chunk, len)) {
+      if (this->compression_active_) {
+        // the encoder history already holds this chunk
+        ESP_LOGE(TAG, "Compressed chunk could not be sent, disconnecting to resynchronise");
+        this->disconnect();
+      }
+      break;
+    }
+    if (this->compression_active_) {
+      this->parent_->stats_.on_compressed(consumed, len);
+    }
+    if (source == this->tx_buffer_.get()) {
+      source->consume(consumed);
+      this->track_tx_level_();
+    } else {
+      this->broadcast_offset_ += consumed;
+    }
+    ESP_LOGVV(TAG, "TX notify #%u: %s", this->index_, format_hex_pretty(chunk, len).c_str());
+    this->parent_->stats_.on_tx_chunk(len);
+    this->last_activity_ms_ = millis();
+  }
+}
 
-  this->tx_in_progress_ = true;
-  this->tx_char_->set_value(std::vector<uint8_t>(chunk.begin(), chunk.end()));
-  this->tx_char_->notify();
-  ESP_LOGVV(TAG, "TX notify: %s", format_hex_pretty(chunk.data(), pulled).c_str());
-  this->last_activity_ms_ = millis();
-  this->on_sent_.trigger();
-  this->tx_in_progress_ = false;
+bool BLENUSServerLink::send_notification_(const uint8_t *data, size_t len) {
+  esp_err_t err = this->parent_->notify_(this->conn_id_, data, len);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Notify to central #%u failed: %d", this->index_, err);
+    this->parent_->stats_.on_write_failure();
+    return false;
+  }
+  this->tx_in_flight_++;
+  return true;
 }
 
-void BLENUSServerComponent::write_array(const uint8_t *data, size_t len) {
-  if (data == nullptr || len == 0 || this->tx_buffer_ == nullptr) {
+void BLENUSServerLink::on_notification_sent_(bool ok) {
+  if (this->tx_in_flight_ > 0) {
+    this->tx_in_flight_--;
+  }
+  if (!ok) {
+    this->parent_->stats_.on_write_failure();
+  }
+  this->pump_();
+  if (this->tx_idle_()) {
+    ESP_LOGV(TAG, "TX to central #%u completed", this->index_);
+    this->parent_->on_sent_.trigger();
+    this->check_flush_();
+  }
+}
+
+void BLENUSServerLink::write_array(const uint8_t *data, size_t len) {
+  ble_nus_common::ByteRing *target = this->tx_target_();
+  if (data == nullptr || len == 0 || target == nullptr) {
     return;
   }
-  size_t written = this->tx_buffer_->write_without_replacement(data, len, 0, true);
+  size_t written = target->write(data, len);
   if (written < len) {
     ESP_LOGW(TAG, "TX buffer overflow, dropped %zu bytes", len - written);
+    this->parent_->stats_.on_dropped(len - written);
   }
+  this->track_tx_level_();
   this->last_activity_ms_ = millis();
+  this->parent_->enable_loop();
 }
 
-bool BLENUSServerComponent::peek_byte(uint8_t *data) {
-  if (this->peek_valid_) {
-    if (data != nullptr) {
-      *data = this->peek_byte_;
-    }
-    this->last_activity_ms_ = millis();
-    return true;
+bool BLENUSServerLink::write_frame(const uint8_t *data, size_t len) {
+  ble_nus_common::ByteRing *target = this->tx_target_();
+  if (target == nullptr || !ble_nus_common::push_frame(*target, data, len)) {
+    ESP_LOGW(TAG, "No room for a %zu byte frame in the TX buffer", len);
+    return false;
   }
+  this->track_tx_level_();
+  this->last_activity_ms_ = millis();
+  this->parent_->enable_loop();
+  return true;
+}
 
-  if (this->rx_buffer_ == nullptr || this->rx_buffer_->available() == 0) {
+bool BLENUSServerLink::read_frame(std::vector<uint8_t> &frame) { return this->pop_frame_(frame); }
+
+bool BLENUSServerLink::pop_frame_(std::vector<uint8_t> &frame) {
+  if (!this->parent_->framing_ || this->rx_buffer_ == nullptr) {
     return false;
   }
+  size_t skipped = 0;
+  const bool found = ble_nus_common::pop_frame(*this->rx_buffer_, this->parent_->max_frame_size_, frame, skipped);
+  if (skipped > 0) {
+    ESP_LOGW(TAG, "Discarded %zu bytes outside valid frames", skipped);
+    this->parent_->stats_.on_frame_error(skipped);
+  }
+  if (found || skipped > 0) {
+    this->rx_messages_.on_consumed();
+    this->track_rx_level_();
+    this->last_activity_ms_ = millis();
+    this->parent_->enable_loop();
+  }
+  return found;
+}
+
+void BLENUSServerLink::dispatch_frames_() {
+  std::vector<uint8_t> frame;
+  while (this->pop_frame_(frame)) {
+    this->parent_->on_frame_.trigger(frame);
+  }
+}
+
+void BLENUSServerLink::dispatch_messages_() {
+  if (this->rx_buffer_ == nullptr) {
+    return;
+  }
+  std::vector<uint8_t> message;
+  while (this->rx_messages_.pop(*this->rx_buffer_, millis(), message)) {
+    this->track_rx_level_();
+    this->last_activity_ms_ = millis();
+    this->parent_->on_message_.trigger(message);
+  }
+}
+
+bool BLENUSServerLink::peek_byte(uint8_t *data) {
   uint8_t tmp{0};
-  size_t read = this->rx_buffer_->read(&tmp, 1, 0);
-  if (read == 0) {
+  if (this->rx_buffer_ == nullptr || !this->rx_buffer_->peek_byte(&tmp)) {
     return false;
   }
-  this->peek_byte_ = tmp;
-  this->peek_valid_ = true;
   if (data != nullptr) {
     *data = tmp;
   }
@@ -99,64 +320,438 @@ bool BLENUSServerComponent::peek_byte(uint8_t *data) {
   return true;
 }
 
-bool BLENUSServerComponent::read_array(uint8_t *data, size_t len) {
+bool BLENUSServerLink::read_array(uint8_t *data, size_t len) {
   if (data == nullptr || len == 0) {
     return true;
   }
-  size_t remaining = len;
-  size_t offset = 0;
+  // all-or-nothing: a short read leaves the ring untouched
+  if (this->rx_buffer_ == nullptr || this->rx_buffer_->available() < len) {
+    return false;
+  }
+  this->rx_buffer_->read(data, len);
+  this->rx_messages_.on_consumed();
+  this->track_rx_level_();
+  this->last_activity_ms_ = millis();
+  // a drained RX ring can change the connection profile
+  this->parent_->enable_loop();
+  return true;
+}
 
-  if (this->peek_valid_) {
-    data[0] = this->peek_byte_;
-    this->peek_valid_ = false;
-    remaining--;
-    offset = 1;
+int BLENUSServerLink::available() {
+  if (this->rx_buffer_ == nullptr) {
+    return 0;
   }
+  return static_cast<int>(this->rx_buffer_->available());
+}
 
-  if (remaining == 0) {
-    this->last_activity_ms_ = millis();
-    return true;
+uart::UARTFlushResult BLENUSServerLink::flush() {
+  if (this->tx_idle_()) {
+    return uart::UARTFlushResult::UART_FLUSH_RESULT_SUCCESS;
+  }
+  if (!ble_nus_common::wait_tx_drained(
+          this->parent_->tx_flush_timeout_ms_, [this]() { return this->tx_idle_(); },
+          [this]() { this->parent_->pump_all_(); })) {
+    // called from a BLE event: cannot wait here, so complete asynchronously through on_flush_complete
+    this->flush_async(nullptr);
+    return uart::UARTFlushResult::UART_FLUSH_RESULT_ASSUMED_SUCCESS;
+  }
+  this->check_flush_();
+  if (!this->tx_idle_()) {
+    ESP_LOGW(TAG, "Flush timeout (%u ms) on central #%u", this->parent_->tx_flush_timeout_ms_, this->index_);
+    return uart::UARTFlushResult::UART_FLUSH_RESULT_TIMEOUT;
+  }
+  return uart::UARTFlushResult::UART_FLUSH_RESULT_SUCCESS;
+}
+
+void BLENUSServerLink::flush_async(std::function<void(bool)> &&callback) {
+  if (callback) {
+    this->flush_callbacks_.push_back(std::move(callback));
+  }
+  if (!this->flush_pending_) {
+    this->flush_pending_ = true;
+    this->flush_started_ms_ = millis();
+    this->parent_->enable_loop();
+  }
+  this->check_flush_();
+}
+
+void BLENUSServerLink::track_rx_level_() {
+  const size_t level = this->rx_buffer_->available();
+  this->parent_->stats_.track_rx_level(level);
+  switch (this->rx_watermark_.update(level)) {
+    case ble_nus_common::Watermark::ROSE_ABOVE_HIGH:
+      ESP_LOGW(TAG, "RX buffer above high watermark (%zu/%zu bytes)", level, this->rx_buffer_->capacity());
+      if (this->parent_->rx_overflow_policy_ == ble_nus_common::RxOverflowPolicy::PAUSE) {
+        this->set_rx_paused_(true);
+      }
+      this->parent_->on_rx_high_watermark_.trigger();
+      break;
+    case ble_nus_common::Watermark::FELL_BELOW_LOW:
+      ESP_LOGD(TAG, "RX buffer back below low watermark (%zu/%zu bytes)", level, this->rx_buffer_->capacity());
+      if (this->rx_paused_) {
+        this->set_rx_paused_(false);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void BLENUSServerLink::set_rx_paused_(bool paused) {
+  if (!this->connected_) {
+    this->rx_paused_ = false;
+    this->rx_pause_retry_ = false;
+    return;
+  }
+  // a long interval caps how many writes the central can land per second
+  const bool ok = paused ? this->request_conn_params_(320, 400, 0, 600) : this->request_conn_params_(6, 24, 0, 400);
+  if (!ok) {
+    // the watermark reports each crossing once; retry_rx_pause_() takes it from here
+    ESP_LOGW(TAG, "Failed to %s RX, retrying in %u ms", paused ? "pause" : "resume",
+             BLENUSServerComponent::RX_PAUSE_RETRY_MS);
+    this->rx_pause_retry_ = true;
+    this->rx_pause_failed_ms_ = millis();
+    return;
+  }
+  ESP_LOGD(TAG, "RX from central #%u %s", this->index_, paused ? "paused" : "resumed");
+  this->rx_paused_ = paused;
+  this->rx_pause_retry_ = false;
+  // connection profiles start over from the parameters asked for here
+  this->conn_profile_ = ConnProfile::NONE;
+}
+
+void BLENUSServerLink::retry_rx_pause_() {
+  if (!this->rx_pause_retry_ || millis() - this->rx_pause_failed_ms_ < BLENUSServerComponent::RX_PAUSE_RETRY_MS) {
+    return;
+  }
+  this->rx_pause_retry_ = false;
+  // paused exactly while above the high watermark, as the crossings in track_rx_level_() would have left it
+  const bool paused = this->rx_watermark_.is_above();
+  if (paused != this->rx_paused_) {
+    this->set_rx_paused_(paused);
+  }
+}
+
+void BLENUSServerLink::update_conn_profile_() {
+  if (!this->parent_->conn_profiles_enabled_ || !this->connected_ || this->rx_paused_) {
+    return;
+  }
+  if (this->conn_params_pending_) {
+    // unanswered or rejected requests are retried after a pause, never back-to-back
+    if (millis() - this->conn_params_request_ms_ < BLENUSServerComponent::CONN_PROFILE_RETRY_MS) {
+      return;
+    }
+    this->conn_params_pending_ = false;
+  }
+  const bool busy = this->data_queued_() ||
+                    (this->conn_profile_ == ConnProfile::BULK &&
+                     millis() - this->last_activity_ms_ < this->parent_->conn_profile_idle_delay_ms_);
+  ConnProfile wanted = busy ? ConnProfile::BULK : ConnProfile::IDLE;
+  if (wanted == this->conn_profile_ || (wanted == ConnProfile::IDLE && this->conn_profile_ == ConnProfile::NONE)) {
+    return;
+  }
+  const auto &params =
+      wanted == ConnProfile::BULK ? this->parent_->bulk_conn_params_ : this->parent_->idle_conn_params_;
+  if (!this->request_conn_params_(params.min_interval, params.max_interval, params.latency, params.timeout)) {
+    return;
   }
+  ESP_LOGD(TAG, "Requesting %s connection profile for central #%u (TX backlog %zu bytes)",
+           wanted == ConnProfile::BULK ? "bulk" : "idle", this->index_, this->tx_backlog_());
+  this->conn_profile_ = wanted;
+}
+
+size_t BLENUSServerLink::tx_backlog_() {
+  size_t offset = 0;
+  const ble_nus_common::ByteRing *source = this->tx_source_(&offset);
+  return source != nullptr ? source->available() - offset : 0;
+}
 
-  if (this->rx_buffer_ == nullptr || this->rx_buffer_->available() < remaining) {
+bool BLENUSServerLink::data_queued_() {
+  // a backlog that one notification cannot carry asks for a fast link; the central's own choice is kept until then
+  return this->tx_backlog_() > static_cast<size_t>(this->mtu_ - 3) ||
+         (this->rx_buffer_ != nullptr && !this->rx_buffer_->empty());
+}
+
+bool BLENUSServerLink::request_conn_params_(uint16_t min_interval, uint16_t max_interval, uint16_t latency,
+                                            uint16_t timeout) {
+  // intervals in 1.25 ms, timeout in 10 ms
+  esp_ble_conn_update_params_t update{};
+  memcpy(update.bda, this->remote_bda_, sizeof(esp_bd_addr_t));
+  update.min_int = min_interval;
+  update.max_int = max_interval;
+  update.latency = latency;
+  update.timeout = timeout;
+  // a refused request also waits out the retry pause, so a failing stack is not asked again on every loop
+  this->conn_params_pending_ = true;
+  this->conn_params_request_ms_ = millis();
+  esp_err_t err = esp_ble_gap_update_conn_params(&update);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Connection parameter update request failed: %d", err);
     return false;
   }
+  return true;
+}
 
-  size_t read = this->rx_buffer_->read(data + offset, remaining, 0);
-  if (read == remaining) {
-    this->last_activity_ms_ = millis();
-    return true;
+void BLENUSServerLink::on_conn_params_(uint16_t interval, uint16_t latency, uint16_t timeout) {
+  this->conn_params_pending_ = false;
+  this->conn_interval_ = interval;
+  ESP_LOGD(TAG, "Central #%u connection parameters: interval %.2f ms, latency %u, timeout %u ms", this->index_,
+           interval * 1.25f, latency, timeout * 10);
+}
+
+void BLENUSServerLink::track_tx_level_() {
+  ble_nus_common::ByteRing *target = this->tx_target_();
+  const size_t level = target->available();
+  this->parent_->stats_.track_tx_level(level);
+  switch (this->tx_watermark_.update(level)) {
+    case ble_nus_common::Watermark::ROSE_ABOVE_HIGH:
+      ESP_LOGW(TAG, "TX buffer above high watermark (%zu/%zu bytes)", level, target->capacity());
+      break;
+    case ble_nus_common::Watermark::FELL_BELOW_LOW:
+      ESP_LOGD(TAG, "TX buffer back below low watermark (%zu/%zu bytes)", level, target->capacity());
+      break;
+    default:
+      break;
+  }
+}
+
+bool BLENUSServerLink::tx_idle_() const {
+  const ble_nus_common::ByteRing *target = this->tx_target_();
+  return this->tx_in_flight_ == 0 && (target == nullptr || target->empty());
+}
+
+void BLENUSServerLink::check_flush_() {
+  if (!this->flush_pending_) {
+    return;
+  }
+  const bool done = this->tx_idle_();
+  if (!done) {
+    if (millis() - this->flush_started_ms_ <= this->parent_->tx_flush_timeout_ms_) {
+      return;
+    }
+    ESP_LOGW(TAG, "Flush timeout (%u ms) with %zu bytes pending", this->parent_->tx_flush_timeout_ms_,
+             this->tx_target_()->available());
+  }
+  this->complete_flush_(done);
+}
+
+void BLENUSServerLink::complete_flush_(bool done) {
+  this->flush_pending_ = false;
+  auto callbacks = std::move(this->flush_callbacks_);
+  this->flush_callbacks_.clear();
+  for (auto &callback : callbacks) {
+    callback(done);
+  }
+  this->parent_->on_flush_complete_.trigger(done);
+}
+
+void BLENUSServerLink::handle_rx_write_(const uint8_t *data, uint16_t len) {
+  if (data == nullptr || len == 0 || this->rx_buffer_ == nullptr) {
+    return;
+  }
+  auto &stats = this->parent_->stats_;
+  const auto policy = this->parent_->rx_overflow_policy_;
+  stats.on_rx_chunk(len);
+  size_t lost = 0;
+  if (this->compression_active_) {
+    size_t raw = 0;
+    const bool ok = this->rx_decoder_.decode_chunk(data, len, [&](const uint8_t *out, size_t n) {
+      raw += n;
+      lost += ble_nus_common::store_rx(*this->rx_buffer_, out, n, policy);
+    });
+    stats.on_compressed(raw, len);
+    if (!ok) {
+      ESP_LOGE(TAG, "Malformed compressed chunk, disconnecting to resynchronise");
+      this->disconnect();
+    }
+  } else {
+    lost = ble_nus_common::store_rx(*this->rx_buffer_, data, len, policy);
+  }
+  if (lost > 0) {
+    ESP_LOGW(TAG, "RX buffer overflow, dropped %zu bytes", lost);
+    stats.on_dropped(lost);
+    if (policy == ble_nus_common::RxOverflowPolicy::DROP_OLDEST) {
+      this->rx_messages_.on_consumed();
+    }
+  }
+  this->track_rx_level_();
+  this->last_activity_ms_ = millis();
+}
+
+void BLENUSServerLink::handle_compression_write_(const uint8_t *data, uint16_t len) {
+  if (this->compression_active_) {
+    // switching again mid-stream would desynchronise the codec histories
+    ESP_LOGW(TAG, "Repeated compression request, disconnecting to resynchronise");
+    this->disconnect();
+    return;
+  }
+  if (len != 1 || data[0] != ble_nus_common::LZ_VERSION) {
+    ESP_LOGD(TAG, "Central asked for unsupported compression version, staying uncompressed");
+    return;
+  }
+  // the write response goes out before this runs, so the central switches no earlier than we do
+  this->tx_encoder_.reset();
+  this->rx_decoder_.reset();
+  this->compression_active_ = true;
+  ESP_LOGD(TAG, "Compression enabled by central");
+}
+
+void BLENUSServerComponent::setup() {
+  if (this->broadcast_) {
+    this->broadcast_buffer_ = ble_nus_common::create_byte_ring(this->tx_buffer_size_, this->buffers_in_psram_);
+  }
+  this->links_.insert(this->links_.begin(), &this->primary_);
+  bool allocated = !this->broadcast_ || this->broadcast_buffer_ != nullptr;
+  for (size_t i = 0; i < this->links_.size() && allocated; i++) {
+    allocated = this->links_[i]->setup_(this, i);
+  }
+  if (!allocated) {
+    ESP_LOGE(TAG, "Failed to allocate RX/TX buffers (%zu/%zu bytes per central)", this->rx_buffer_size_,
+             this->tx_buffer_size_);
+    this->mark_failed();
+    return;
+  }
+  if (this->framing_) {
+    this->max_frame_size_ = std::min(this->max_frame_size_, this->rx_buffer_size_ - ble_nus_common::FRAME_OVERHEAD);
+  }
+  this->tx_chunk_.resize(this->desired_mtu_ - 3);
+  if (this->compression_) {
+    this->tx_raw_.resize(COMPRESS_INPUT_MAX);
+  }
+  this->init_gatt_();
+  if (this->auto_advertise_) {
+    this->start_advertising();
+  }
+#ifdef USE_SENSOR
+  if (this->stats_update_interval_ms_ > 0) {
+    this->set_interval("stats", this->stats_update_interval_ms_, [this]() { this->publish_stats_(); });
+  }
+#endif
+}
+
+void BLENUSServerComponent::loop() {
+  for (auto *link : this->links_) {
+    link->loop_();
+  }
+  this->trim_broadcast_();
+  this->sleep_until_needed_();
+}
+
+void BLENUSServerComponent::pump_all_() {
+  // a broadcast only leaves the shared ring once every subscribed link has sent it
+  for (auto *link : this->links_) {
+    link->pump_();
+  }
+  this->trim_broadcast_();
+}
+
+void BLENUSServerComponent::sleep_until_needed_() {
+  // GATTS/GAP events and UART writes re-enable the loop; otherwise it only has to run at the links' deadlines
+  const uint32_t now = millis();
+  uint32_t wait = UINT32_MAX;
+  for (auto *link : this->links_) {
+    wait = std::min(wait, link->loop_wait_(now));
+  }
+  if (wait == 0) {
+    return;
+  }
+  this->disable_loop();
+  if (wait != UINT32_MAX) {
+    this->set_timeout("wake", wait, [this]() { this->enable_loop(); });
+  }
+}
+
+void BLENUSServerComponent::dump_config() {
+  ESP_LOGCONFIG(TAG, "UART Nordic Server (BLE NUS)");
+  ESP_LOGCONFIG(TAG, "  Centrals: up to %zu%s", this->links_.size(),
+                this->broadcast_ ? ", UART writes broadcast to all" : "");
+  ESP_LOGCONFIG(TAG, "  Buffers: RX %zu / TX %zu bytes per central%s", this->rx_buffer_size_, this->tx_buffer_size_,
+                this->buffers_in_psram_ ? " (PSRAM preferred)" : "");
+  if (this->high_watermark_pct_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Watermarks: high %u%%, low %u%%", this->high_watermark_pct_, this->low_watermark_pct_);
+  }
+  ESP_LOGCONFIG(TAG, "  RX overflow policy: %s", ble_nus_common::rx_overflow_policy_to_str(this->rx_overflow_policy_));
+  if (this->compression_) {
+    ESP_LOGCONFIG(TAG, "  Compression: LZ v%u, negotiated per link", ble_nus_common::LZ_VERSION);
+  }
+  if (this->framing_) {
+    ESP_LOGCONFIG(TAG, "  Framing: up to %zu byte payloads%s", this->max_frame_size_,
+                  this->frame_dispatch_ ? ", delivered via on_frame" : "");
+  }
+  if (this->message_dispatch_) {
+    ESP_LOGCONFIG(TAG, "  Messages: up to %zu bytes, idle gap %u ms, max latency %u ms, %zu byte delimiter",
+                  this->rx_messages_.max_size(), this->rx_messages_.idle_gap_ms(), this->rx_messages_.max_latency_ms(),
+                  this->rx_messages_.delimiter_len());
+  }
+}
+
+bool BLENUSServerComponent::is_connected() const {
+  for (auto *link : this->links_) {
+    if (link->is_connected()) {
+      return true;
+    }
   }
   return false;
 }
 
-int BLENUSServerComponent::available() {
-  if (this->rx_buffer_ == nullptr) {
-    return 0;
+BLENUSServerLink *BLENUSServerComponent::find_link_(uint16_t conn_id) {
+  for (auto *link : this->links_) {
+    if (link->connected_ && link->conn_id_ == conn_id) {
+      return link;
+    }
   }
-  return static_cast<int>(this->rx_buffer_->available() + (this->peek_valid_ ? 1 : 0));
+  return nullptr;
 }
 
-void BLENUSServerComponent::flush() {
-  const uint32_t start = millis();
-  while (this->tx_in_progress_ || (this->tx_buffer_ != nullptr && this->tx_buffer_->available() > 0)) {
-    if (millis() - start > this->tx_flush_timeout_ms_) {
-      ESP_LOGW(TAG, "Flush timeout (%u ms) with %zu bytes pending", this->tx_flush_timeout_ms_,
-               this->tx_buffer_ != nullptr ? this->tx_buffer_->available() : 0);
-      break;
+BLENUSServerLink *BLENUSServerComponent::find_link_(const esp_bd_addr_t bda) {
+  for (auto *link : this->links_) {
+    if (link->connected_ && memcmp(link->remote_bda_, bda, sizeof(esp_bd_addr_t)) == 0) {
+      return link;
     }
-    delay(5);
-    yield();
   }
+  return nullptr;
+}
+
+void BLENUSServerComponent::trim_broadcast_() {
+  if (this->broadcast_buffer_ == nullptr) {
+    return;
+  }
+  // the shared ring is released up to the slowest subscribed central; nothing is released while none listens
+  size_t sent = SIZE_MAX;
+  for (auto *link : this->links_) {
+    if (link->connected_ && link->notifications_enabled_) {
+      sent = std::min(sent, link->broadcast_offset_);
+    }
+  }
+  if (sent == SIZE_MAX || sent == 0) {
+    return;
+  }
+  this->broadcast_buffer_->consume(sent);
+  for (auto *link : this->links_) {
+    link->broadcast_offset_ = link->broadcast_offset_ > sent ? link->broadcast_offset_ - sent : 0;
+  }
+  this->primary_.track_tx_level_();
+}
+
+esp_err_t BLENUSServerComponent::notify_(uint16_t conn_id, const uint8_t *data, size_t len) {
+  if (this->server_ == nullptr || this->tx_char_ == nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  // addressed to one connection, unlike BLECharacteristic::notify() which goes to every client
+  return esp_ble_gatts_send_indicate(this->server_->get_gatts_if(), conn_id, this->tx_char_->get_handle(), len,
+                                     const_cast<uint8_t *>(data), false);
 }
 
 void BLENUSServerComponent::start_advertising() {
-  if (this->server_ == nullptr) {
+  if (this->server_ == nullptr || this->service_ == nullptr) {
     ESP_LOGW(TAG, "BLE server not initialized, cannot advertise");
     return;
   }
   ESP_LOGI(TAG, "Starting BLE advertising");
+  // starting the service is a no-op once it runs; the controller stops advertising on every connection, so
+  // advertising itself is restarted each time
   this->service_->start();
+  esp32_ble::global_ble->advertising_start();
 }
 
 void BLENUSServerComponent::stop_advertising() {
@@ -172,22 +767,48 @@ void BLENUSServerComponent::disconnect() {
     return;
   }
   ESP_LOGI(TAG, "Disconnecting BLE clients");
-  this->service_->stop();
-  this->connected_ = false;
-  this->notifications_enabled_ = false;
-  this->on_disconnected_.trigger();
+  for (auto *link : this->links_) {
+    link->disconnect();
+  }
 }
 
-void BLENUSServerComponent::handle_rx_write_(const uint8_t *data, uint16_t len) {
-  if (data == nullptr || len == 0 || this->rx_buffer_ == nullptr) {
-    return;
-  }
-  size_t written = this->rx_buffer_->write(data, len);
-  if (written < len) {
-    ESP_LOGW(TAG, "RX buffer overflow, dropped %u bytes", static_cast<unsigned>(len - written));
+#ifdef USE_SENSOR
+void BLENUSServerComponent::publish_stats_() {
+  const uint32_t now = millis();
+  const float tx_rate = this->tx_rate_.sample(this->stats_.bytes_sent(), now);
+  const float rx_rate = this->rx_rate_.sample(this->stats_.bytes_received(), now);
+  if (this->bytes_sent_sensor_ != nullptr)
+    this->bytes_sent_sensor_->publish_state(this->stats_.bytes_sent());
+  if (this->bytes_received_sensor_ != nullptr)
+    this->bytes_received_sensor_->publish_state(this->stats_.bytes_received());
+  if (this->chunks_sent_sensor_ != nullptr)
+    this->chunks_sent_sensor_->publish_state(this->stats_.chunks_sent());
+  if (this->chunks_received_sensor_ != nullptr)
+    this->chunks_received_sensor_->publish_state(this->stats_.chunks_received());
+  if (this->dropped_bytes_sensor_ != nullptr)
+    this->dropped_bytes_sensor_->publish_state(this->stats_.dropped_bytes());
+  if (this->write_failures_sensor_ != nullptr)
+    this->write_failures_sensor_->publish_state(this->stats_.write_failures());
+  if (this->reconnects_sensor_ != nullptr)
+    this->reconnects_sensor_->publish_state(this->stats_.reconnects());
+  if (this->frame_errors_sensor_ != nullptr)
+    this->frame_errors_sensor_->publish_state(this->stats_.frame_errors());
+  if (this->compression_ratio_sensor_ != nullptr) {
+    const float ratio = this->stats_.compression_ratio();
+    this->compression_ratio_sensor_->publish_state(ratio > 0.0f ? ratio : NAN);
   }
-  this->last_activity_ms_ = millis();
+  if (this->rx_high_water_sensor_ != nullptr)
+    this->rx_high_water_sensor_->publish_state(this->stats_.rx_high_water());
+  if (this->tx_high_water_sensor_ != nullptr)
+    this->tx_high_water_sensor_->publish_state(this->stats_.tx_high_water());
+  if (this->tx_throughput_sensor_ != nullptr)
+    this->tx_throughput_sensor_->publish_state(tx_rate);
+  if (this->rx_throughput_sensor_ != nullptr)
+    this->rx_throughput_sensor_->publish_state(rx_rate);
+  if (this->mtu_sensor_ != nullptr)
+    this->mtu_sensor_->publish_state(this->primary_.is_connected() ? this->primary_.get_mtu() : NAN);
 }
+#endif
 
 void BLENUSServerComponent::init_gatt_() {
   this->server_ = esp32_ble_server::global_ble_server;
@@ -196,8 +817,14 @@ void BLENUSServerComponent::init_gatt_() {
     return;
   }
 
-  this->server_->on_connect([this](uint16_t conn_id) { this->on_connect_(conn_id); });
-  this->server_->on_disconnect([this](uint16_t conn_id) { this->on_disconnect_(conn_id); });
+  // connections are tracked from the raw GATTS events, which carry the central's address; GAP events report
+  // connection parameter updates
+  esp32_ble::global_ble->register_gatts_event_handler(this);
+  esp32_ble::global_ble->register_gap_event_handler(this);
+  esp_err_t err = esp_ble_gatt_set_local_mtu(this->desired_mtu_);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to set local MTU %u: %d", this->desired_mtu_, err);
+  }
 
   this->service_ = this->server_->create_service(this->service_uuid_, true, 15);
   if (this->service_ == nullptr) {
@@ -211,34 +838,161 @@ void BLENUSServerComponent::init_gatt_() {
   this->tx_char_ = this->service_->create_characteristic(this->tx_uuid_,
                                                          esp32_ble_server::BLECharacteristic::PROPERTY_NOTIFY);
 
+  if (this->compression_) {
+    // only offered when enabled, so a central that finds the characteristic may switch the link over
+    this->compression_char_ = this->service_->create_characteristic(
+        esp32_ble::ESPBTUUID::from_raw(ble_nus_common::LZ_CHAR_UUID),
+        esp32_ble_server::BLECharacteristic::PROPERTY_READ | esp32_ble_server::BLECharacteristic::PROPERTY_WRITE);
+  }
+
   if (this->tx_char_ != nullptr) {
-    auto cccd = new esp32_ble_server::BLEDescriptor(esp32_ble::ESPBTUUID::from_uint16(ESP_GATT_UUID_CHAR_CLIENT_CONFIG));
-    this->tx_char_->add_descriptor(cccd);
+    this->tx_cccd_ =
+        new esp32_ble_server::BLEDescriptor(esp32_ble::ESPBTUUID::from_uint16(ESP_GATT_UUID_CHAR_CLIENT_CONFIG));
+    this->tx_char_->add_descriptor(this->tx_cccd_);
   }
 
   if (this->rx_char_ != nullptr) {
-    this->rx_char_->on_write([this](std::span<const uint8_t> data, uint16_t) {
-      this->handle_rx_write_(data.data(), data.size());
+    // esp32_ble_server runs these from its own GATTS dispatch, outside gatts_event_handler()
+    this->rx_char_->on_write([this](std::span<const uint8_t> data, uint16_t conn_id) {
+      ble_nus_common::BleDispatchScope dispatch;
+      BLENUSServerLink *link = this->find_link_(conn_id);
+      if (link == nullptr) {
+        return;
+      }
+      link->handle_rx_write_(data.data(), data.size());
       this->on_data_.trigger();
+      if (this->frame_dispatch_) {
+        link->dispatch_frames_();
+      }
+      if (this->message_dispatch_) {
+        link->rx_messages_.on_rx(millis());
+        link->dispatch_messages_();
+      }
+    });
+  }
+
+  if (this->compression_char_ != nullptr) {
+    this->compression_char_->set_value(std::vector<uint8_t>{ble_nus_common::LZ_VERSION});
+    this->compression_char_->on_write([this](std::span<const uint8_t> data, uint16_t conn_id) {
+      ble_nus_common::BleDispatchScope dispatch;
+      if (BLENUSServerLink *link = this->find_link_(conn_id)) {
+        link->handle_compression_write_(data.data(), data.size());
+      }
     });
   }
 
   this->server_->enqueue_start_service(this->service_);
 }
 
-void BLENUSServerComponent::on_connect_(uint16_t conn_id) {
-  ESP_LOGI(TAG, "Client connected (conn_id=%u)", conn_id);
-  this->connected_ = true;
-  this->conn_id_ = conn_id;
-  this->notifications_enabled_ = true;  // assume CCCD written by client; adjust if needed
-  this->last_activity_ms_ = millis();
+void BLENUSServerComponent::gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
+                                                esp_ble_gatts_cb_param_t *param) {
+  if (this->server_ == nullptr || gatts_if != this->server_->get_gatts_if()) {
+    return;
+  }
+  ble_nus_common::BleDispatchScope dispatch;
+  this->enable_loop();
+  switch (event) {
+    case ESP_GATTS_CONNECT_EVT:
+      this->on_connect_(param->connect.conn_id, param->connect.remote_bda);
+      if (BLENUSServerLink *link = this->find_link_(param->connect.conn_id)) {
+        link->on_conn_params_(param->connect.conn_params.interval, param->connect.conn_params.latency,
+                              param->connect.conn_params.timeout);
+      }
+      break;
+    case ESP_GATTS_MTU_EVT:
+      if (BLENUSServerLink *link = this->find_link_(param->mtu.conn_id)) {
+        link->mtu_ = param->mtu.mtu;
+        ESP_LOGD(TAG, "Central #%u MTU %u", link->index_, link->mtu_);
+      }
+      break;
+    case ESP_GATTS_WRITE_EVT: {
+      // esp32_ble_server answers the CCCD write; only the subscription state is taken from it here
+      BLENUSServerLink *link = this->find_link_(param->write.conn_id);
+      if (link == nullptr || this->tx_cccd_ == nullptr || param->write.handle != this->tx_cccd_->get_handle() ||
+          param->write.is_prep || param->write.len < 1) {
+        break;
+      }
+      link->notifications_enabled_ = (param->write.value[0] & 0x01) != 0;
+      ESP_LOGD(TAG, "Central #%u %s notifications", link->index_,
+               link->notifications_enabled_ ? "subscribed to" : "unsubscribed from");
+      link->pump_();
+    } break;
+    case ESP_GATTS_DISCONNECT_EVT:
+      this->on_disconnect_(param->disconnect.conn_id);
+      break;
+    case ESP_GATTS_CONF_EVT: {
+      // reported for notifications too, once the stack has passed them on
+      BLENUSServerLink *link = this->find_link_(param->conf.conn_id);
+      if (link != nullptr && this->tx_char_ != nullptr && param->conf.handle == this->tx_char_->get_handle()) {
+        link->on_notification_sent_(param->conf.status == ESP_GATT_OK);
+      }
+    } break;
+    case ESP_GATTS_CONGEST_EVT: {
+      BLENUSServerLink *link = this->find_link_(param->congest.conn_id);
+      if (link != nullptr) {
+        link->tx_congested_ = param->congest.congested;
+        if (!link->tx_congested_) {
+          link->pump_();
+        }
+      }
+    } break;
+    default:
+      break;
+  }
+}
+
+void BLENUSServerComponent::gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+  if (event != ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT) {
+    return;
+  }
+  ble_nus_common::BleDispatchScope dispatch;
+  BLENUSServerLink *link = this->find_link_(param->update_conn_params.bda);
+  if (link == nullptr) {
+    return;
+  }
+  this->enable_loop();
+  if (param->update_conn_params.status != ESP_BT_STATUS_SUCCESS) {
+    ESP_LOGW(TAG, "Central #%u rejected connection parameters: %d", link->index_, param->update_conn_params.status);
+    // stays pending, so update_conn_profile_() retries after CONN_PROFILE_RETRY_MS
+    link->conn_profile_ = BLENUSServerLink::ConnProfile::NONE;
+    return;
+  }
+  link->on_conn_params_(param->update_conn_params.conn_int, param->update_conn_params.latency,
+                        param->update_conn_params.timeout);
+}
+
+void BLENUSServerComponent::on_connect_(uint16_t conn_id, const esp_bd_addr_t bda) {
+  BLENUSServerLink *free_link = nullptr;
+  size_t connected = 0;
+  for (auto *link : this->links_) {
+    if (link->connected_) {
+      connected++;
+    } else if (free_link == nullptr) {
+      free_link = link;
+    }
+  }
+  if (free_link == nullptr) {
+    ESP_LOGW(TAG, "No free slot for central (conn_id=%u), closing", conn_id);
+    esp_ble_gatts_close(this->server_->get_gatts_if(), conn_id);
+    return;
+  }
+  ESP_LOGI(TAG, "Central #%u connected (conn_id=%u)", free_link->index_, conn_id);
+  free_link->on_connect_(conn_id, bda);
+  this->stats_.on_link_up();
   this->on_connected_.trigger();
+  // the controller stops advertising once a connection is made
+  if (this->auto_advertise_ && connected + 1 < this->links_.size()) {
+    this->start_advertising();
+  }
 }
 
 void BLENUSServerComponent::on_disconnect_(uint16_t conn_id) {
-  ESP_LOGI(TAG, "Client disconnected (conn_id=%u)", conn_id);
-  this->connected_ = false;
-  this->notifications_enabled_ = false;
+  BLENUSServerLink *link = this->find_link_(conn_id);
+  if (link == nullptr) {
+    return;
+  }
+  ESP_LOGI(TAG, "Central #%u disconnected (conn_id=%u)", link->index_, conn_id);
+  link->on_disconnect_();
   this->on_disconnected_.trigger();
   if (this->auto_advertise_) {
     this->start_advertising();
@@ -7,82 +7,319 @@
 #include "esphome/components/esp32_ble_server/ble_service.h"
 #include "esphome/components/esp32_ble_server/ble_characteristic.h"
 #include "esphome/core/automation.h"
-#include "esphome/core/ring_buffer.h"
+#include "esphome/components/ble_nus_common/byte_ring.h"
+#include "esphome/components/ble_nus_common/frame_codec.h"
+#include "esphome/components/ble_nus_common/lz_codec.h"
+#include "esphome/components/ble_nus_common/message_coalescer.h"
+#include "esphome/components/ble_nus_common/rx_overflow.h"
+#include "esphome/components/ble_nus_common/watermark.h"
+#include "esphome/components/ble_nus_common/transport_stats.h"
+
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+
+#include <functional>
+#include <memory>
+#include <vector>
 
 namespace esphome {
 namespace ble_nus_server {
 
-class BLENUSServerComponent : public uart::UARTComponent, public Component {
- public:
-  void setup() override;
-  void loop() override;
-  void dump_config() override;
-  float get_setup_priority() const override { return setup_priority::DATA; }
+class BLENUSServerComponent;
 
+/// State and UART facade of one connected central.
+///
+/// The server owns the link behind its own UART interface; additional links are declared in YAML and are
+/// assigned, in order, to further centrals as they connect.
+class BLENUSServerLink : public uart::UARTComponent {
+ public:
   // UART interface
   void write_array(const uint8_t *data, size_t len) override;
   bool peek_byte(uint8_t *data) override;
   bool read_array(uint8_t *data, size_t len) override;
   int available() override;
-  void flush() override;
+  uart::UARTFlushResult flush() override;
+  /// Non-blocking flush: `callback(true)` fires once all queued TX data has been sent,
+  /// `callback(false)` if that did not happen within the flush timeout.
+  void flush_async(std::function<void(bool)> &&callback);
   void check_logger_conflict() override {}
 
+  /// Queues `data` as one frame (see frame_codec.h). All-or-nothing: false if the frame does not fit.
+  bool write_frame(const uint8_t *data, size_t len);
+  /// Takes the next complete, CRC-checked frame out of the RX buffer. Needs `framing` enabled.
+  bool read_frame(std::vector<uint8_t> &frame);
+
+  void disconnect();
+  bool is_connected() const { return this->connected_; }
+  uint16_t get_conn_id() const { return this->conn_id_; }
+  uint16_t get_mtu() const { return this->mtu_; }
+  /// Connection interval in 1.25 ms units, 0 while disconnected.
+  uint16_t get_conn_interval() const { return this->conn_interval_; }
+  bool is_subscribed() const { return this->notifications_enabled_; }
+
+ protected:
+  friend class BLENUSServerComponent;
+
+  // Connection-parameter profile requested from the central; NONE leaves the central's choice in place
+  enum class ConnProfile : uint8_t {
+    NONE,
+    BULK,
+    IDLE,
+  };
+
+  bool setup_(BLENUSServerComponent *parent, uint8_t index);
+  void loop_();
+  uint32_t loop_wait_(uint32_t now);
+  void on_connect_(uint16_t conn_id, const esp_bd_addr_t bda);
+  void on_disconnect_();
+  void handle_rx_write_(const uint8_t *data, uint16_t len);
+  void handle_compression_write_(const uint8_t *data, uint16_t len);
+  void pump_();
+  bool send_notification_(const uint8_t *data, size_t len);
+  void on_notification_sent_(bool ok);
+  ble_nus_common::ByteRing *tx_source_(size_t *offset);
+  ble_nus_common::ByteRing *tx_target_() const;
+  bool tx_idle_() const;
+  void track_rx_level_();
+  void track_tx_level_();
+  void set_rx_paused_(bool paused);
+  void update_conn_profile_();
+  size_t tx_backlog_();
+  bool data_queued_();
+  bool request_conn_params_(uint16_t min_interval, uint16_t max_interval, uint16_t latency, uint16_t timeout);
+  void on_conn_params_(uint16_t interval, uint16_t latency, uint16_t timeout);
+  bool pop_frame_(std::vector<uint8_t> &frame);
+  void dispatch_frames_();
+  void dispatch_messages_();
+  void check_flush_();
+  void complete_flush_(bool done);
+  void retry_rx_pause_();
+
+  BLENUSServerComponent *parent_{nullptr};
+  uint8_t index_{0};
+
+  bool connected_{false};
+  bool notifications_enabled_{false};
+  uint16_t conn_id_{0};
+  uint16_t mtu_{23};
+  esp_bd_addr_t remote_bda_{};
+  uint16_t conn_interval_{0};
+  ConnProfile conn_profile_{ConnProfile::NONE};
+  bool conn_params_pending_{false};
+  uint32_t conn_params_request_ms_{0};
+
+  std::unique_ptr<ble_nus_common::ByteRing> rx_buffer_;
+  // unicast TX; null for the server's own link in broadcast mode, whose writes go to the shared ring
+  std::unique_ptr<ble_nus_common::ByteRing> tx_buffer_;
+  // broadcast: bytes of the shared ring this link has sent beyond its read position
+  size_t broadcast_offset_{0};
+  // a link drains one source before switching, so frames from the two streams never interleave
+  bool sending_broadcast_{false};
+
+  ble_nus_common::Watermark rx_watermark_;
+  ble_nus_common::Watermark tx_watermark_;
+  // PAUSE policy: the central is asked for a slow connection interval until the consumer drains below the low
+  // watermark (write responses are sent by esp32_ble_server and cannot be held back)
+  bool rx_paused_{false};
+  // a pause/resume request failed; loop_() retries until rx_paused_ matches the watermark
+  bool rx_pause_retry_{false};
+  uint32_t rx_pause_failed_ms_{0};
+  // compression: switched on by the central's write to the compression characteristic, see lz_codec.h
+  bool compression_active_{false};
+  ble_nus_common::LzEncoder tx_encoder_;
+  ble_nus_common::LzDecoder rx_decoder_;
+  ble_nus_common::MessageCoalescer rx_messages_;
+
+  // notifications handed to the stack but not yet reported by ESP_GATTS_CONF_EVT
+  uint16_t tx_in_flight_{0};
+  bool tx_congested_{false};
+  bool flush_pending_{false};
+  uint32_t flush_started_ms_{0};
+  std::vector<std::function<void(bool)>> flush_callbacks_;
+  uint32_t last_activity_ms_{0};
+};
+
+class BLENUSServerComponent : public uart::UARTComponent,
+                              public Component,
+                              public esp32_ble::GATTsEventHandler,
+                              public esp32_ble::GAPEventHandler {
+ public:
+  void setup() override;
+  void loop() override;
+  void dump_config() override;
+  float get_setup_priority() const override { return setup_priority::DATA; }
+
+  // UART interface, backed by the server's own link (or, in broadcast mode, fanned out to all centrals on write)
+  void write_array(const uint8_t *data, size_t len) override { this->primary_.write_array(data, len); }
+  bool peek_byte(uint8_t *data) override { return this->primary_.peek_byte(data); }
+  bool read_array(uint8_t *data, size_t len) override { return this->primary_.read_array(data, len); }
+  int available() override { return this->primary_.available(); }
+  uart::UARTFlushResult flush() override { return this->primary_.flush(); }
+  void flush_async(std::function<void(bool)> &&callback) { this->primary_.flush_async(std::move(callback)); }
+
+  bool write_frame(const uint8_t *data, size_t len) { return this->primary_.write_frame(data, len); }
+  bool read_frame(std::vector<uint8_t> &frame) { return this->primary_.read_frame(frame); }
+  void check_logger_conflict() override {}
+
+  void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
+                           esp_ble_gatts_cb_param_t *param) override;
+  void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) override;
+
   // Config setters
   void set_service_uuid(const char *uuid) { this->service_uuid_ = esp32_ble::ESPBTUUID::from_raw(uuid); }
   void set_rx_uuid(const char *uuid) { this->rx_uuid_ = esp32_ble::ESPBTUUID::from_raw(uuid); }
   void set_tx_uuid(const char *uuid) { this->tx_uuid_ = esp32_ble::ESPBTUUID::from_raw(uuid); }
   void set_passkey(uint32_t pin) { this->passkey_ = pin % 1000000U; }
   void set_mtu(uint16_t mtu) { this->desired_mtu_ = mtu; }
+  void set_flush_timeout(uint32_t timeout_ms) { this->tx_flush_timeout_ms_ = timeout_ms; }
+  void set_rx_buffer_size(size_t size) { this->rx_buffer_size_ = size; }
+  void set_tx_buffer_size(size_t size) { this->tx_buffer_size_ = size; }
+  void set_buffers_in_psram(bool enabled) { this->buffers_in_psram_ = enabled; }
+  void set_framing(size_t max_frame_size) {
+    this->framing_ = true;
+    this->max_frame_size_ = max_frame_size;
+  }
+  void set_frame_dispatch(bool enabled) { this->frame_dispatch_ = enabled; }
+  void set_message_dispatch(uint32_t idle_gap_ms, size_t max_size, uint32_t max_latency_ms,
+                            const std::vector<uint8_t> &delimiter) {
+    this->rx_messages_.configure(idle_gap_ms, max_size, max_latency_ms, delimiter.data(), delimiter.size());
+    this->message_dispatch_ = true;
+  }
+  void set_compression(bool enabled) { this->compression_ = enabled; }
+  void set_rx_overflow_policy(ble_nus_common::RxOverflowPolicy policy) { this->rx_overflow_policy_ = policy; }
+  void set_watermarks(uint8_t high_pct, uint8_t low_pct) {
+    this->high_watermark_pct_ = high_pct;
+    this->low_watermark_pct_ = low_pct;
+  }
   void set_idle_disconnect_timeout(uint32_t timeout_ms) { this->idle_disconnect_timeout_ms_ = timeout_ms; }
   void set_autoadvertise(bool enabled) { this->auto_advertise_ = enabled; }
+  void set_broadcast(bool enabled) { this->broadcast_ = enabled; }
+  void set_bulk_conn_params(uint16_t min_interval, uint16_t max_interval, uint16_t latency, uint16_t timeout) {
+    this->bulk_conn_params_ = {min_interval, max_interval, latency, timeout};
+    this->conn_profiles_enabled_ = true;
+  }
+  void set_idle_conn_params(uint16_t min_interval, uint16_t max_interval, uint16_t latency, uint16_t timeout) {
+    this->idle_conn_params_ = {min_interval, max_interval, latency, timeout};
+    this->conn_profiles_enabled_ = true;
+  }
+  void set_conn_profile_idle_delay(uint32_t delay_ms) { this->conn_profile_idle_delay_ms_ = delay_ms; }
+  /// Adds the UART facade for the next central slot.
+  void add_link(BLENUSServerLink *link) { this->links_.push_back(link); }
 
   Trigger<> *get_on_connected_trigger() { return &this->on_connected_; }
   Trigger<> *get_on_disconnected_trigger() { return &this->on_disconnected_; }
   Trigger<> *get_on_sent_trigger() { return &this->on_sent_; }
   Trigger<> *get_on_data_trigger() { return &this->on_data_; }
+  Trigger<bool> *get_on_flush_complete_trigger() { return &this->on_flush_complete_; }
+  Trigger<> *get_on_rx_high_watermark_trigger() { return &this->on_rx_high_watermark_; }
+  Trigger<std::vector<uint8_t>> *get_on_frame_trigger() { return &this->on_frame_; }
+  Trigger<std::vector<uint8_t>> *get_on_message_trigger() { return &this->on_message_; }
 
   // Actions
   void start_advertising();
   void stop_advertising();
+  /// Disconnects every central.
   void disconnect();
-  bool is_connected() const { return this->connected_; }
+  /// True while at least one central is connected.
+  bool is_connected() const;
+
+  const ble_nus_common::TransportStats &get_stats() const { return this->stats_; }
+  uint16_t get_mtu() const { return this->primary_.get_mtu(); }
+
+#ifdef USE_SENSOR
+  void set_stats_update_interval(uint32_t interval_ms) { this->stats_update_interval_ms_ = interval_ms; }
+  SUB_SENSOR(bytes_sent)
+  SUB_SENSOR(bytes_received)
+  SUB_SENSOR(chunks_sent)
+  SUB_SENSOR(chunks_received)
+  SUB_SENSOR(dropped_bytes)
+  SUB_SENSOR(write_failures)
+  SUB_SENSOR(reconnects)
+  SUB_SENSOR(frame_errors)
+  SUB_SENSOR(compression_ratio)
+  SUB_SENSOR(mtu)
+  SUB_SENSOR(rx_high_water)
+  SUB_SENSOR(tx_high_water)
+  SUB_SENSOR(tx_throughput)
+  SUB_SENSOR(rx_throughput)
+#endif
 
  protected:
-  void handle_idle_();
-  void publish_notifications_();
-  void handle_rx_write_(const uint8_t *data, uint16_t len);
-  void init_gatt_();
-  void on_connect_(uint16_t conn_id);
+  friend class BLENUSServerLink;
+
+  // In controller units: intervals 1.25 ms, supervision timeout 10 ms
+  struct ConnParams {
+    uint16_t min_interval;
+    uint16_t max_interval;
+    uint16_t latency;
+    uint16_t timeout;
+  };
+
+  BLENUSServerLink *find_link_(uint16_t conn_id);
+  BLENUSServerLink *find_link_(const esp_bd_addr_t bda);
+  void on_connect_(uint16_t conn_id, const esp_bd_addr_t bda);
   void on_disconnect_(uint16_t conn_id);
+  void trim_broadcast_();
+  // pumps every link and trims the broadcast ring; the blocking flush calls it between BLE dispatch rounds
+  void pump_all_();
+  void sleep_until_needed_();
+  esp_err_t notify_(uint16_t conn_id, const uint8_t *data, size_t len);
+  void init_gatt_();
+#ifdef USE_SENSOR
+  void publish_stats_();
+#endif
 
-  bool connected_{false};
-  bool notifications_enabled_{false};
   bool auto_advertise_{true};
-
-  uint16_t mtu_{23};
   uint16_t desired_mtu_{247};
-  uint16_t conn_id_{0};
-
-  uint16_t chr_rx_handle_{0};
-  uint16_t chr_tx_handle_{0};
-  uint16_t chr_cccd_handle_{0};
 
-  static constexpr size_t RX_BUFFER_CAPACITY = 512;
-  std::unique_ptr<esphome::RingBuffer> rx_buffer_;
+  // links_[0] is primary_, then the declared links; one slot per central
+  BLENUSServerLink primary_;
+  std::vector<BLENUSServerLink *> links_;
+  // broadcast: writes to the server's UART interface are queued once and sent to every subscribed central
+  bool broadcast_{false};
+  std::unique_ptr<ble_nus_common::ByteRing> broadcast_buffer_;
 
-  static constexpr size_t TX_BUFFER_CAPACITY = 512;
-  std::unique_ptr<esphome::RingBuffer> tx_buffer_;
+  // connection profiles: BULK once a link's TX backlog outgrows one notification, IDLE after idle_delay of quiet
+  static constexpr uint32_t CONN_PROFILE_RETRY_MS = 5000;
+  static constexpr uint32_t RX_PAUSE_RETRY_MS = 1000;
+  bool conn_profiles_enabled_{false};
+  ConnParams bulk_conn_params_{6, 12, 0, 200};
+  ConnParams idle_conn_params_{80, 160, 4, 600};
+  uint32_t conn_profile_idle_delay_ms_{3000};
 
-  bool peek_valid_{false};
-  uint8_t peek_byte_{0};
+  size_t rx_buffer_size_{512};
+  size_t tx_buffer_size_{512};
+  bool buffers_in_psram_{false};
+  // watermarks in percent of buffer size, 0 disables tracking
+  uint8_t high_watermark_pct_{0};
+  uint8_t low_watermark_pct_{0};
+  ble_nus_common::RxOverflowPolicy rx_overflow_policy_{ble_nus_common::RxOverflowPolicy::DROP_NEWEST};
+  // framing: max_frame_size_ is clamped to what the RX buffer can hold; frame_dispatch_ feeds on_frame
+  static constexpr size_t COMPRESS_INPUT_MAX = ble_nus_common::LZ_MAX_CHUNK_INPUT;
+  bool compression_{false};
+  bool framing_{false};
+  bool frame_dispatch_{false};
+  size_t max_frame_size_{0};
+  // message_dispatch_ feeds on_message; each link cuts its own stream with a copy of rx_messages_
+  bool message_dispatch_{false};
+  ble_nus_common::MessageCoalescer rx_messages_;
+  // staging shared by all links, for compressed chunks and for chunks that straddle a ring's wrap point;
+  // the stack copies each notification before esp_ble_gatts_send_indicate() returns
+  std::vector<uint8_t> tx_chunk_;
+  std::vector<uint8_t> tx_raw_;
 
-  bool tx_in_progress_{false};
   uint32_t tx_flush_timeout_ms_{2000};
-
-  uint32_t last_activity_ms_{0};
   uint32_t idle_disconnect_timeout_ms_{0};
   uint32_t passkey_{0};
 
+  ble_nus_common::TransportStats stats_;
+#ifdef USE_SENSOR
+  uint32_t stats_update_interval_ms_{0};
+  ble_nus_common::ThroughputWindow tx_rate_;
+  ble_nus_common::ThroughputWindow rx_rate_;
+#endif
+
   esp32_ble::ESPBTUUID service_uuid_;
   esp32_ble::ESPBTUUID rx_uuid_;
   esp32_ble::ESPBTUUID tx_uuid_;
@@ -90,11 +327,17 @@ class BLENUSServerComponent : public uart::UARTComponent, public Component {
   esp32_ble_server::BLEService *service_{nullptr};
   esp32_ble_server::BLECharacteristic *rx_char_{nullptr};
   esp32_ble_server::BLECharacteristic *tx_char_{nullptr};
+  esp32_ble_server::BLEDescriptor *tx_cccd_{nullptr};
+  esp32_ble_server::BLECharacteristic *compression_char_{nullptr};
 
   Trigger<> on_connected_;
   Trigger<> on_disconnected_;
   Trigger<> on_sent_;
   Trigger<> on_data_;
+  Trigger<bool> on_flush_complete_;
+  Trigger<> on_rx_high_watermark_;
+  Trigger<std::vector<uint8_t>> on_frame_;
+  Trigger<std::vector<uint8_t>> on_message_;
 };
 
 class StartAdvertisingAction : public Action<> {
@@ -0,0 +1,93 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import (
+    CONF_UPDATE_INTERVAL,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_BYTES,
+)
+
+from . import BLENUSServerComponent
+
+CONF_BLE_NUS_SERVER_ID = "ble_nus_server_id"
+
+UNIT_BYTES_PER_SECOND = "B/s"
+
+CONF_BYTES_SENT = "bytes_sent"
+CONF_BYTES_RECEIVED = "bytes_received"
+CONF_CHUNKS_SENT = "chunks_sent"
+CONF_CHUNKS_RECEIVED = "chunks_received"
+CONF_DROPPED_BYTES = "dropped_bytes"
+CONF_WRITE_FAILURES = "write_failures"
+CONF_RECONNECTS = "reconnects"
+CONF_FRAME_ERRORS = "frame_errors"
+CONF_COMPRESSION_RATIO = "compression_ratio"
+CONF_MTU = "mtu"
+CONF_RX_HIGH_WATER = "rx_high_water"
+CONF_TX_HIGH_WATER = "tx_high_water"
+CONF_TX_THROUGHPUT = "tx_throughput"
+CONF_RX_THROUGHPUT = "rx_throughput"
+
+_COUNTER_SCHEMA = sensor.sensor_schema(
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+_BYTE_COUNTER_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_BYTES,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+_LEVEL_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_BYTES,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+_RATE_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_BYTES_PER_SECOND,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+
+SENSORS = {
+    CONF_BYTES_SENT: _BYTE_COUNTER_SCHEMA,
+    CONF_BYTES_RECEIVED: _BYTE_COUNTER_SCHEMA,
+    CONF_CHUNKS_SENT: _COUNTER_SCHEMA,
+    CONF_CHUNKS_RECEIVED: _COUNTER_SCHEMA,
+    CONF_DROPPED_BYTES: _BYTE_COUNTER_SCHEMA,
+    CONF_WRITE_FAILURES: _COUNTER_SCHEMA,
+    CONF_RECONNECTS: _COUNTER_SCHEMA,
+    CONF_FRAME_ERRORS: _BYTE_COUNTER_SCHEMA,
+    CONF_COMPRESSION_RATIO: sensor.sensor_schema(
+        accuracy_decimals=2,
+        state_class=STATE_CLASS_MEASUREMENT,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    ),
+    CONF_MTU: _LEVEL_SCHEMA,
+    CONF_RX_HIGH_WATER: _LEVEL_SCHEMA,
+    CONF_TX_HIGH_WATER: _LEVEL_SCHEMA,
+    CONF_TX_THROUGHPUT: _RATE_SCHEMA,
+    CONF_RX_THROUGHPUT: _RATE_SCHEMA,
+}
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(CONF_BLE_NUS_SERVER_ID): cv.use_id(BLENUSServerComponent),
+        cv.Optional(CONF_UPDATE_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+        **{cv.Optional(key): schema for key, schema in SENSORS.items()},
+    }
+)
+
+
+async def to_code(config):
+    parent = await cg.get_variable(config[CONF_BLE_NUS_SERVER_ID])
+    cg.add(parent.set_stats_update_interval(config[CONF_UPDATE_INTERVAL]))
+    for key in SENSORS:
+        if key in config:
+            sens = await sensor.new_sensor(config[key])
+            cg.add(getattr(parent, f"set_{key}_sensor")(sens))
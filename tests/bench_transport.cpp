@@ -0,0 +1,242 @@
+// Host benchmark of the portable NUS hot paths. Reports bytes/s and CPU time per KiB for ByteRing access
+// patterns, the MTU-chunked link (with per-chunk latency percentiles), framing, the LZ codec (with its compression
+// ratio) and message cutting.
+// Run `bench_transport [seconds per case]`; numbers are for regression tracking, not absolute ESP32 figures.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "ble_nus_common/frame_codec.h"
+#include "ble_nus_common/message_coalescer.h"
+#include "sim_link.h"
+
+using namespace esphome::ble_nus_common;
+
+static double g_seconds = 0.2;
+
+static double cpu_seconds() {
+  timespec ts{};
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// repeats `round` (which moves `bytes_per_round` bytes) for about g_seconds of CPU time
+template<typename Round> static void measure(const char *name, size_t bytes_per_round, Round &&round) {
+  size_t rounds = 0;
+  const double start = cpu_seconds();
+  double elapsed = 0;
+  do {
+    for (int i = 0; i < 16; i++) {
+      round();
+    }
+    rounds += 16;
+    elapsed = cpu_seconds() - start;
+  } while (elapsed < g_seconds);
+  const double bytes = static_cast<double>(bytes_per_round) * rounds;
+  std::printf("  %-44s %10.1f MB/s %10.1f ns/KiB\n", name, bytes / elapsed / 1e6, elapsed * 1e9 / (bytes / 1024));
+}
+
+static std::vector<uint8_t> load_profile(size_t len) {
+  std::string text;
+  for (int i = 0; text.size() < len; i++) {
+    text += "1.8.0(" + std::to_string(100000 + i * 7) + ".123*kWh)(24-05-" + std::to_string(10 + i % 20) +
+            " 12:" + std::to_string(10 + i % 50) + ")\r\n";
+  }
+  return {text.begin(), text.begin() + len};
+}
+
+static std::vector<uint8_t> pseudo_random(size_t len) {
+  std::vector<uint8_t> out(len);
+  uint32_t seed = 1;
+  for (auto &byte : out) {
+    seed = seed * 1664525 + 1013904223;
+    byte = static_cast<uint8_t>(seed >> 24);
+  }
+  return out;
+}
+
+static void bench_ring() {
+  std::printf("ByteRing (512 bytes, 200-byte writes so reads keep crossing the wrap)\n");
+  auto ring = ByteRing::create(512);
+  const auto data = pseudo_random(200);
+  std::vector<uint8_t> out(200);
+  volatile uint8_t sink = 0;
+  measure("write + read_byte (peek_byte, consume)", data.size(), [&]() {
+    ring->write(data.data(), data.size());
+    uint8_t byte;
+    while (ring->peek_byte(&byte)) {
+      ring->consume(1);
+      sink = sink + byte;
+    }
+  });
+  measure("write + peek_byte(offset) scan + consume", data.size(), [&]() {
+    ring->write(data.data(), data.size());
+    uint8_t byte;
+    for (size_t i = 0; ring->peek_byte(&byte, i); i++) {
+      sink = sink + byte;
+    }
+    ring->consume(data.size());
+  });
+  measure("write + read_array (bulk read)", data.size(), [&]() {
+    ring->write(data.data(), data.size());
+    ring->read(out.data(), out.size());
+  });
+  measure("writable/commit + readable/consume", data.size(), [&]() {
+    for (size_t done = 0; done < data.size();) {
+      auto span = ring->writable();
+      const size_t n = std::min(span.size(), data.size() - done);
+      std::copy(data.begin() + done, data.begin() + done + n, span.begin());
+      ring->commit(n);
+      done += n;
+    }
+    while (!ring->empty()) {
+      auto span = ring->readable();
+      sink = sink + span[span.size() - 1];
+      ring->consume(span.size());
+    }
+  });
+}
+
+static void bench_link() {
+  std::printf("Simulated link, 2 KiB writes, TX ring -> MTU-3 chunks -> RX ring -> read_array\n");
+  const auto text = load_profile(2048);
+  std::vector<uint8_t> out(1024);
+  for (bool compress : {false, true}) {
+    for (size_t mtu : {23, 27, 64, 185, 247, 517}) {
+      SimLink link(mtu, 1024, 1024, compress);
+      std::vector<double> latencies;
+      latencies.reserve(1 << 16);
+      char name[64];
+      std::snprintf(name, sizeof(name), "MTU %3zu%s", mtu, compress ? " + LZ" : "");
+      measure(name, text.size(), [&]() {
+        for (size_t sent = 0; sent < text.size();) {
+          sent += link.tx().write(text.data() + sent, text.size() - sent);
+          while (true) {
+            const auto t0 = std::chrono::steady_clock::now();
+            const size_t len = link.pump_chunk();
+            const auto t1 = std::chrono::steady_clock::now();
+            if (len == 0) {
+              break;
+            }
+            if (latencies.size() < latencies.capacity()) {
+              latencies.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count());
+            }
+            link.rx().read(out.data(), std::min(out.size(), link.rx().available()));
+          }
+        }
+      });
+      std::sort(latencies.begin(), latencies.end());
+      auto pct = [&latencies](double p) { return latencies[static_cast<size_t>(p * (latencies.size() - 1))]; };
+      std::printf("  %-44s per chunk p50 %.0f ns, p90 %.0f ns, p99 %.0f ns; %.2f wire/raw bytes\n", "", pct(0.5),
+                  pct(0.9), pct(0.99), static_cast<double>(link.wire_bytes()) / link.raw_bytes());
+    }
+  }
+}
+
+static void bench_frames() {
+  std::printf("Framing (CRC-16 over the ring)\n");
+  auto ring = ByteRing::create(1024);
+  std::vector<uint8_t> out;
+  out.reserve(1024);
+  size_t skipped = 0;
+  for (size_t len : {16, 200, 1000}) {
+    const auto payload = pseudo_random(len);
+    char name[64];
+    std::snprintf(name, sizeof(name), "push_frame + pop_frame, %zu-byte payload", len);
+    measure(name, len, [&]() {
+      push_frame(*ring, payload.data(), payload.size());
+      pop_frame(*ring, 1024, out, skipped);
+    });
+  }
+}
+
+static void bench_lz() {
+  std::printf("LZ codec: compression ratio (raw/wire) and CPU cost per payload size, 8 KiB of input\n");
+  struct Input {
+    const char *name;
+    std::vector<uint8_t> data;
+  };
+  const Input inputs[] = {{"OBIS load profile", load_profile(8192)}, {"random", pseudo_random(8192)}};
+  std::vector<uint8_t> decoded(LZ_MAX_CHUNK_INPUT);
+  for (const auto &input : inputs) {
+    for (size_t payload : {20, 64, 244}) {
+      // one pass up front for the chunks the decoder replays and for the ratio
+      std::vector<std::vector<uint8_t>> chunks;
+      size_t wire = 0;
+      {
+        LzEncoder encoder;
+        std::vector<uint8_t> chunk(payload);
+        for (size_t pos = 0; pos < input.data.size();) {
+          size_t consumed = 0;
+          const size_t len =
+              encoder.encode_chunk(input.data.data() + pos, std::min(LZ_MAX_CHUNK_INPUT, input.data.size() - pos),
+                                   chunk.data(), chunk.size(), &consumed);
+          chunks.emplace_back(chunk.begin(), chunk.begin() + len);
+          wire += len;
+          pos += consumed;
+        }
+      }
+      std::printf("  %s, %zu-byte payloads: %.2fx\n", input.name, payload,
+                  static_cast<double>(input.data.size()) / wire);
+      std::vector<uint8_t> chunk(payload);
+      measure("encode", input.data.size(), [&]() {
+        LzEncoder encoder;
+        for (size_t pos = 0; pos < input.data.size();) {
+          size_t consumed = 0;
+          encoder.encode_chunk(input.data.data() + pos, std::min(LZ_MAX_CHUNK_INPUT, input.data.size() - pos),
+                               chunk.data(), chunk.size(), &consumed);
+          pos += consumed;
+        }
+      });
+      measure("decode", input.data.size(), [&]() {
+        LzDecoder decoder;
+        for (const auto &c : chunks) {
+          decoder.decode_chunk(c.data(), c.size(), [&](const uint8_t *data, size_t n) {
+            std::copy(data, data + n, decoded.begin());
+          });
+        }
+      });
+    }
+  }
+}
+
+static void bench_messages() {
+  std::printf("Message cutting (CRLF lines out of a 1 KiB ring)\n");
+  auto ring = ByteRing::create(1024);
+  const auto text = load_profile(1000);
+  const uint8_t crlf[] = {'\r', '\n'};
+  MessageCoalescer messages;
+  messages.configure(20, 256, 0, crlf, sizeof(crlf));
+  std::vector<uint8_t> out;
+  out.reserve(256);
+  uint32_t now = 0;
+  measure("on_rx per 20-byte chunk + pop", text.size(), [&]() {
+    for (size_t pos = 0; pos < text.size(); pos += 20) {
+      ring->write(text.data() + pos, std::min<size_t>(20, text.size() - pos));
+      messages.on_rx(now);
+      while (messages.pop(*ring, now, out)) {
+      }
+    }
+    now += 100;
+    while (messages.pop(*ring, now, out)) {
+    }
+  });
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    g_seconds = std::max(0.01, std::atof(argv[1]));
+  }
+  bench_ring();
+  bench_link();
+  bench_frames();
+  bench_lz();
+  bench_messages();
+  return 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdio>
+
+// Minimal assertion helpers for the host tests; each test binary returns the number of failed checks.
+
+inline int &host_test_failures() {
+  static int failures = 0;
+  return failures;
+}
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      host_test_failures()++; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(a, b) \
+  do { \
+    const auto check_a_ = (a); \
+    const auto check_b_ = (b); \
+    if (!(check_a_ == check_b_)) { \
+      std::fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, \
+                   static_cast<long long>(check_a_), static_cast<long long>(check_b_)); \
+      host_test_failures()++; \
+    } \
+  } while (0)
+
+/// Prints the verdict for `name` and returns the process exit code.
+inline int host_test_result(const char *name) {
+  if (host_test_failures() == 0) {
+    std::printf("%s: ok\n", name);
+    return 0;
+  }
+  std::printf("%s: %d check(s) failed\n", name, host_test_failures());
+  return 1;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "ble_nus_common/byte_ring.h"
+#include "ble_nus_common/lz_codec.h"
+#include "ble_nus_common/rx_overflow.h"
+#include "ble_nus_common/tx_chunker.h"
+
+namespace esphome {
+namespace ble_nus_common {
+
+/// One direction of a NUS link without the radio: the sender's TX ring is cut into ATT payloads of MTU-3 bytes
+/// by next_tx_chunk(), as in the client and the server (optionally LZ-compressed), and each payload is stored
+/// into the receiver's RX ring through store_rx(). `on_air` may inspect or damage payloads in flight.
+class SimLink {
+ public:
+  static constexpr size_t COMPRESS_INPUT_MAX = LZ_MAX_CHUNK_INPUT;
+
+  SimLink(size_t mtu, size_t tx_size, size_t rx_size, bool compress = false,
+          RxOverflowPolicy policy = RxOverflowPolicy::DROP_NEWEST)
+      : tx_(ByteRing::create(tx_size)),
+        rx_(ByteRing::create(rx_size)),
+        max_payload_(mtu > 3 ? mtu - 3 : 20),
+        compress_(compress),
+        policy_(policy),
+        staging_(max_payload_),
+        raw_(COMPRESS_INPUT_MAX),
+        air_(max_payload_) {}
+
+  ByteRing &tx() { return *this->tx_; }
+  ByteRing &rx() { return *this->rx_; }
+  size_t max_payload() const { return this->max_payload_; }
+  size_t lost() const { return this->lost_; }
+  size_t raw_bytes() const { return this->raw_bytes_; }
+  size_t wire_bytes() const { return this->wire_bytes_; }
+  size_t chunks() const { return this->chunks_; }
+  bool decode_failed() const { return this->decode_failed_; }
+
+  std::function<void(uint8_t *chunk, size_t len)> on_air;
+
+  /// Sends one payload; returns its size on the air, or 0 when the TX ring is empty.
+  size_t pump_chunk() {
+    const TxChunk next = next_tx_chunk(*this->tx_, 0, this->max_payload_, this->staging_.data(),
+                                       this->compress_ ? &this->encoder_ : nullptr, this->raw_.data());
+    const size_t len = next.len;
+    const size_t consumed = next.consumed;
+    if (len == 0) {
+      return 0;
+    }
+    // the BLE stack copies the value before the write call returns; so does the air
+    std::copy(next.data, next.data + len, this->air_.begin());
+    this->tx_->consume(consumed);
+    if (this->on_air) {
+      this->on_air(this->air_.data(), len);
+    }
+    this->receive_(this->air_.data(), len);
+    this->raw_bytes_ += consumed;
+    this->wire_bytes_ += len;
+    this->chunks_++;
+    return len;
+  }
+
+  /// Sends until the TX ring is empty; returns the number of payloads.
+  size_t pump() {
+    size_t n = 0;
+    while (this->pump_chunk() > 0) {
+      n++;
+    }
+    return n;
+  }
+
+ protected:
+  void receive_(const uint8_t *data, size_t len) {
+    if (!this->compress_) {
+      this->lost_ += store_rx(*this->rx_, data, len, this->policy_);
+      return;
+    }
+    const bool ok = this->decoder_.decode_chunk(
+        data, len, [this](const uint8_t *out, size_t n) { this->lost_ += store_rx(*this->rx_, out, n, this->policy_); });
+    this->decode_failed_ |= !ok;
+  }
+
+  std::unique_ptr<ByteRing> tx_;
+  std::unique_ptr<ByteRing> rx_;
+  const size_t max_payload_;
+  const bool compress_;
+  const RxOverflowPolicy policy_;
+  std::vector<uint8_t> staging_;
+  std::vector<uint8_t> raw_;
+  std::vector<uint8_t> air_;
+  LzEncoder encoder_;
+  LzDecoder decoder_;
+  size_t lost_{0};
+  size_t raw_bytes_{0};
+  size_t wire_bytes_{0};
+  size_t chunks_{0};
+  bool decode_failed_{false};
+};
+
+}  // namespace ble_nus_common
+}  // namespace esphome
@@ -0,0 +1,195 @@
+// ByteRing index arithmetic, wrap handling, offset views and ring_find().
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "ble_nus_common/byte_ring.h"
+#include "host_test.h"
+
+using namespace esphome::ble_nus_common;
+
+// model of the ring contents, to compare against after every step
+struct Model {
+  std::vector<uint8_t> bytes;
+  uint8_t next{0};
+};
+
+static void check_contents(const ByteRing &ring, const Model &model) {
+  CHECK_EQ(ring.available(), model.bytes.size());
+  CHECK_EQ(ring.free(), ring.capacity() - model.bytes.size());
+  CHECK_EQ(ring.empty(), model.bytes.empty());
+  std::vector<uint8_t> copy(model.bytes.size());
+  CHECK_EQ(ring.peek(copy.data(), copy.size()), model.bytes.size());
+  CHECK(copy == model.bytes);
+  // readable(offset) spans stitch together into the same bytes
+  for (size_t offset = 0; offset < model.bytes.size(); offset += 3) {
+    auto span = ring.readable(offset);
+    CHECK(!span.empty());
+    CHECK(std::memcmp(span.data(), model.bytes.data() + offset, span.size()) == 0);
+    auto rest = ring.readable(offset + span.size());
+    CHECK(std::memcmp(rest.data(), model.bytes.data() + offset + span.size(), rest.size()) == 0);
+    CHECK_EQ(span.size() + rest.size(), model.bytes.size() - offset);
+    uint8_t byte = 0;
+    CHECK(ring.peek_byte(&byte, offset));
+    CHECK_EQ(byte, model.bytes[offset]);
+  }
+  CHECK(ring.readable(model.bytes.size()).empty());
+  uint8_t byte = 0;
+  CHECK(!ring.peek_byte(&byte, model.bytes.size()));
+}
+
+static void test_index_arithmetic_over_many_laps() {
+  // small capacities so the [0, 2 * capacity) positions lap many times, random op sizes so they land anywhere
+  for (size_t capacity : {1, 2, 7, 64}) {
+    auto ring = ByteRing::create(capacity);
+    Model model;
+    uint32_t seed = static_cast<uint32_t>(capacity);
+    for (int step = 0; step < 2000; step++) {
+      seed = seed * 1664525 + 1013904223;
+      const size_t n = (seed >> 16) % (capacity + 2);
+      if ((seed >> 8) & 1) {
+        std::vector<uint8_t> in(n);
+        for (auto &b : in) {
+          b = model.next++;
+        }
+        const size_t stored = ring->write(in.data(), n);
+        CHECK_EQ(stored, std::min(n, capacity - model.bytes.size()));
+        model.next = static_cast<uint8_t>(model.next - (n - stored));
+        model.bytes.insert(model.bytes.end(), in.begin(), in.begin() + stored);
+      } else {
+        std::vector<uint8_t> out(n);
+        const size_t got = ring->read(out.data(), n);
+        CHECK_EQ(got, std::min(n, model.bytes.size()));
+        CHECK(std::equal(out.begin(), out.begin() + got, model.bytes.begin()));
+        model.bytes.erase(model.bytes.begin(), model.bytes.begin() + got);
+      }
+      check_contents(*ring, model);
+    }
+  }
+}
+
+static void test_full_and_empty_are_distinct() {
+  auto ring = ByteRing::create(4);
+  const uint8_t data[] = {1, 2, 3, 4, 5};
+  for (int lap = 0; lap < 5; lap++) {
+    CHECK_EQ(ring->write(data, 5), 4);
+    CHECK_EQ(ring->available(), 4);
+    CHECK(ring->writable().empty());
+    CHECK_EQ(ring->readable().size() + ring->readable(ring->readable().size()).size(), 4);
+    ring->consume(3);
+    CHECK_EQ(ring->available(), 1);
+    ring->consume(10);  // clamped
+    CHECK(ring->empty());
+    CHECK(ring->readable().empty());
+  }
+}
+
+static void test_spans_at_the_wrap_point() {
+  auto ring = ByteRing::create(8);
+  const uint8_t first[] = {0, 1, 2, 3, 4, 5};
+  ring->write(first, sizeof(first));
+  ring->consume(5);
+  // write position is 6: the writable span stops at the end of storage, the rest follows from the start
+  auto w = ring->writable();
+  CHECK_EQ(w.size(), 2);
+  w[0] = 6;
+  w[1] = 7;
+  ring->commit(2);
+  w = ring->writable();
+  CHECK_EQ(w.size(), 5);
+  for (size_t i = 0; i < 3; i++) {
+    w[i] = static_cast<uint8_t>(8 + i);
+  }
+  ring->commit(3);
+  CHECK_EQ(ring->available(), 6);
+  CHECK_EQ(ring->readable().size(), 3);
+  CHECK_EQ(ring->readable(2).size(), 1);
+  CHECK_EQ(ring->readable(3).size(), 3);
+  CHECK_EQ(ring->readable(3)[0], 8);
+  uint8_t buf[6];
+  CHECK_EQ(ring->peek(buf, 4, 1), 4);
+  const uint8_t expected[] = {6, 7, 8, 9};
+  CHECK(std::memcmp(buf, expected, 4) == 0);
+  CHECK_EQ(ring->peek(buf, 10, 4), 2);
+  CHECK_EQ(ring->peek(buf, 1, 6), 0);
+
+  // peek_contiguous: in place when contiguous, staged across the wrap
+  uint8_t staging[6] = {};
+  CHECK(ring->peek_contiguous(3, staging) == ring->readable().data());
+  const uint8_t *stitched = ring->peek_contiguous(5, staging);
+  CHECK(stitched == staging);
+  const uint8_t all[] = {5, 6, 7, 8, 9};
+  CHECK(std::memcmp(stitched, all, 5) == 0);
+  CHECK(ring->peek_contiguous(2, staging, 3) == ring->readable(3).data());
+}
+
+static void test_reset_and_adopt() {
+  static int released = 0;
+  {
+    auto ring = ByteRing::adopt(new uint8_t[16], 16, [](uint8_t *p, size_t capacity) {
+      delete[] p;
+      released += static_cast<int>(capacity);
+    });
+    const uint8_t data[10] = {};
+    ring->write(data, 10);
+    ring->reset();
+    CHECK(ring->empty());
+    CHECK_EQ(ring->writable().size(), 6);
+    CHECK(ByteRing::adopt(nullptr, 16, nullptr) == nullptr);
+    CHECK(ByteRing::create(0) == nullptr);
+  }
+  CHECK_EQ(released, 16);
+}
+
+static void test_ring_find() {
+  auto ring = ByteRing::create(16);
+  const uint8_t crlf[] = {'\r', '\n'};
+  size_t scanned = 0;
+  // fill so that the terminator straddles the wrap point
+  const uint8_t pad[12] = {};
+  ring->write(pad, 12);
+  ring->consume(12);
+  const uint8_t part1[] = {'a', 'b', 'c', '\r'};
+  ring->write(part1, 4);
+  CHECK_EQ(ring_find(*ring, crlf, 2, ring->available(), &scanned), 0);
+  CHECK_EQ(scanned, 4);
+  const uint8_t part2[] = {'\n', 'x', '\r', '\n'};
+  ring->write(part2, 4);
+  // resumes at `scanned` and still sees the '\r' from the earlier pass
+  CHECK_EQ(ring_find(*ring, crlf, 2, ring->available(), &scanned), 5);
+  // the limit bounds the search
+  scanned = 0;
+  CHECK_EQ(ring_find(*ring, crlf, 2, 4, &scanned), 0);
+  CHECK_EQ(scanned, 4);
+  // once the front moves, the search starts over
+  ring->consume(5);
+  scanned = 0;
+  CHECK_EQ(ring_find(*ring, crlf, 2, ring->available(), &scanned), 3);
+  // single byte and absent needles
+  const uint8_t x = 'x';
+  scanned = 0;
+  CHECK_EQ(ring_find(*ring, &x, 1, ring->available(), &scanned), 1);
+  const uint8_t z = 'z';
+  scanned = 0;
+  CHECK_EQ(ring_find(*ring, &z, 1, ring->available(), &scanned), 0);
+  CHECK_EQ(ring_find(*ring, &z, 0, ring->available(), &scanned), 0);
+  // a match past the first 32-byte peek block
+  auto big = ByteRing::create(128);
+  std::vector<uint8_t> data(100, 'a');
+  data[70] = 'b';
+  big->write(data.data(), data.size());
+  const uint8_t ab[] = {'a', 'b'};
+  scanned = 0;
+  CHECK_EQ(ring_find(*big, ab, 2, big->available(), &scanned), 71);
+}
+
+int main() {
+  test_index_arithmetic_over_many_laps();
+  test_full_and_empty_are_distinct();
+  test_spans_at_the_wrap_point();
+  test_reset_and_adopt();
+  test_ring_find();
+  return host_test_result("test_byte_ring");
+}
@@ -0,0 +1,309 @@
+// End-to-end checks of the portable transport pieces: TX ring -> MTU chunking (+ LZ) -> RX ring -> framing and
+// message cutting, over a simulated link.
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ble_nus_common/frame_codec.h"
+#include "ble_nus_common/message_coalescer.h"
+#include "ble_nus_common/request_pipeline.h"
+#include "ble_nus_common/response_matcher.h"
+#include "host_test.h"
+#include "sim_link.h"
+
+using namespace esphome::ble_nus_common;
+
+static const size_t MTUS[] = {23, 27, 185, 247, 517};
+
+// OBIS-like load profile text, the case compression is meant for
+static std::vector<uint8_t> load_profile(size_t len) {
+  std::string text;
+  for (int i = 0; text.size() < len; i++) {
+    text += "1.8.0(" + std::to_string(100000 + i * 7) + ".123*kWh)(24-05-" + std::to_string(10 + i % 20) +
+            " 12:" + std::to_string(10 + i % 50) + ")\r\n";
+  }
+  return {text.begin(), text.begin() + len};
+}
+
+static std::vector<uint8_t> pseudo_random(size_t len, uint32_t seed) {
+  std::vector<uint8_t> out(len);
+  for (auto &byte : out) {
+    seed = seed * 1664525 + 1013904223;
+    byte = static_cast<uint8_t>(seed >> 24);
+  }
+  return out;
+}
+
+// streams `data` through the link in ring-sized slices and returns what the receiver read back
+static std::vector<uint8_t> stream(SimLink &link, const std::vector<uint8_t> &data) {
+  std::vector<uint8_t> received;
+  std::vector<uint8_t> block(link.rx().capacity());
+  for (size_t sent = 0; sent < data.size() || !link.tx().empty();) {
+    sent += link.tx().write(data.data() + sent, data.size() - sent);
+    while (link.pump_chunk() > 0) {
+      const size_t n = link.rx().read(block.data(), block.size());
+      received.insert(received.end(), block.begin(), block.begin() + n);
+    }
+  }
+  return received;
+}
+
+static void test_byte_stream_round_trip() {
+  for (size_t mtu : MTUS) {
+    for (bool compress : {false, true}) {
+      // rings smaller than one payload at the big MTUs, so chunks wrap and get staged
+      SimLink link(mtu, 300, 1024, compress);
+      const auto text = load_profile(5000);
+      CHECK(stream(link, text) == text);
+      const auto noise = pseudo_random(5000, mtu);
+      CHECK(stream(link, noise) == noise);
+      CHECK_EQ(link.lost(), 0);
+      CHECK(!link.decode_failed());
+      if (compress && mtu >= 185) {
+        CHECK(link.wire_bytes() < 10000 - 5000 / 2);
+      }
+    }
+  }
+}
+
+static void test_frames_round_trip() {
+  for (size_t mtu : MTUS) {
+    for (bool compress : {false, true}) {
+      SimLink link(mtu, 512, 512, compress);
+      std::vector<uint8_t> out;
+      size_t skipped = 0;
+      for (size_t len : {0, 1, 19, 20, 21, 200, 400, 507}) {
+        const auto payload = pseudo_random(len, static_cast<uint32_t>(len + mtu));
+        CHECK(push_frame(link.tx(), payload.data(), payload.size()));
+        link.pump();
+        CHECK(pop_frame(link.rx(), 512, out, skipped));
+        CHECK(out == payload);
+        CHECK(link.rx().empty());
+      }
+      CHECK_EQ(skipped, 0);
+      // all-or-nothing when the frame cannot fit
+      const auto big = pseudo_random(510, 1);
+      CHECK(!push_frame(link.tx(), big.data(), big.size()));
+      CHECK(link.tx().empty());
+    }
+  }
+}
+
+static void test_frame_resync_after_corruption() {
+  SimLink link(27, 512, 512);
+  bool damage = true;
+  link.on_air = [&damage](uint8_t *chunk, size_t len) {
+    if (damage && len > 10) {
+      chunk[10] ^= 0x40;
+      damage = false;
+    }
+  };
+  const auto first = load_profile(60);
+  const auto second = load_profile(80);
+  push_frame(link.tx(), first.data(), first.size());
+  push_frame(link.tx(), second.data(), second.size());
+  link.pump();
+  std::vector<uint8_t> out;
+  size_t skipped = 0;
+  CHECK(pop_frame(link.rx(), 512, out, skipped));
+  CHECK(out == second);
+  CHECK_EQ(skipped, first.size() + FRAME_OVERHEAD);
+}
+
+static void test_rx_overflow_accounting() {
+  const auto data = pseudo_random(300, 7);
+  {
+    SimLink link(247, 512, 128, false, RxOverflowPolicy::DROP_NEWEST);
+    link.tx().write(data.data(), data.size());
+    link.pump();
+    CHECK_EQ(link.lost(), data.size() - 128);
+    std::vector<uint8_t> kept(128);
+    link.rx().read(kept.data(), kept.size());
+    CHECK(std::equal(kept.begin(), kept.end(), data.begin()));
+  }
+  {
+    SimLink link(247, 512, 128, false, RxOverflowPolicy::DROP_OLDEST);
+    link.tx().write(data.data(), data.size());
+    link.pump();
+    CHECK_EQ(link.lost(), data.size() - 128);
+    std::vector<uint8_t> kept(128);
+    link.rx().read(kept.data(), kept.size());
+    CHECK(std::equal(kept.begin(), kept.end(), data.end() - 128));
+  }
+}
+
+static void test_messages_across_chunks() {
+  SimLink link(23, 256, 256);
+  MessageCoalescer messages;
+  const uint8_t crlf[] = {'\r', '\n'};
+  messages.configure(20, 200, 0, crlf, sizeof(crlf));
+  const auto text = load_profile(400);
+  std::vector<std::vector<uint8_t>> lines;
+  std::vector<uint8_t> out;
+  uint32_t now = 0;
+  for (size_t sent = 0; sent < text.size();) {
+    sent += link.tx().write(text.data() + sent, std::min<size_t>(50, text.size() - sent));
+    while (link.pump_chunk() > 0) {
+      messages.on_rx(now++);
+      while (messages.pop(link.rx(), now, out)) {
+        lines.push_back(out);
+      }
+    }
+  }
+  // the tail without a delimiter leaves on the idle gap
+  CHECK(!messages.pop(link.rx(), now, out));
+  CHECK(messages.pop(link.rx(), now + 20, out));
+  lines.push_back(out);
+  std::vector<uint8_t> joined;
+  for (size_t i = 0; i < lines.size(); i++) {
+    if (i + 1 < lines.size()) {
+      CHECK(lines[i].size() >= 2 && lines[i][lines[i].size() - 2] == '\r' && lines[i].back() == '\n');
+    }
+    joined.insert(joined.end(), lines[i].begin(), lines[i].end());
+  }
+  CHECK(joined == text);
+}
+
+static void test_messages_after_another_reader() {
+  auto ring = ByteRing::create(64);
+  MessageCoalescer messages;
+  const uint8_t crlf[] = {'\r', '\n'};
+  messages.configure(20, 64, 0, crlf, sizeof(crlf));
+  std::vector<uint8_t> out;
+  const std::string part1 = "abcdef\r";
+  ring->write(reinterpret_cast<const uint8_t *>(part1.data()), part1.size());
+  messages.on_rx(0);
+  CHECK(!messages.pop(*ring, 0, out));
+  // read_array() takes bytes the coalescer had already scanned
+  uint8_t taken[4];
+  ring->read(taken, sizeof(taken));
+  messages.on_consumed();
+  const std::string part2 = "\nxy\r\n";
+  ring->write(reinterpret_cast<const uint8_t *>(part2.data()), part2.size());
+  messages.on_rx(1);
+  CHECK(messages.pop(*ring, 1, out));
+  CHECK(std::string(out.begin(), out.end()) == "ef\r\n");
+  CHECK(messages.pop(*ring, 1, out));
+  CHECK(std::string(out.begin(), out.end()) == "xy\r\n");
+}
+
+static void test_response_after_another_reader() {
+  auto ring = ByteRing::create(64);
+  auto matcher = ResponseMatcher::terminator({'\r', '\n'});
+  std::vector<uint8_t> scratch;
+  const std::string part1 = "abcdef\r";
+  ring->write(reinterpret_cast<const uint8_t *>(part1.data()), part1.size());
+  CHECK_EQ(matcher.match(*ring, scratch), 0);
+  uint8_t taken[4];
+  ring->read(taken, sizeof(taken));
+  matcher.reset();
+  const std::string part2 = "\nxy\r\n";
+  ring->write(reinterpret_cast<const uint8_t *>(part2.data()), part2.size());
+  CHECK_EQ(matcher.match(*ring, scratch), 4);
+}
+
+static void test_pipelined_head_timeout() {
+  // the head's response never completes while the second one is already buffered behind it
+  auto ring = ByteRing::create(64);
+  RequestPipeline pipeline;
+  pipeline.set_max_outstanding(2);
+  std::vector<RequestResult> results;
+  auto record = [&results](RequestResult result, const std::vector<uint8_t> &) { results.push_back(result); };
+  for (const char *request : {"a?", "b?", "c?"}) {
+    pipeline.push(std::vector<uint8_t>(request, request + 2), ResponseMatcher::terminator({'\r', '\n'}), 100,
+                  record, 0);
+  }
+  while (pipeline.next_unsent() != nullptr) {
+    pipeline.mark_sent();
+  }
+  CHECK_EQ(pipeline.sent(), 2);
+  const std::string rx = "a-partb-ok\r\n";
+  ring->write(reinterpret_cast<const uint8_t *>(rx.data()), rx.size());
+  CHECK(!pipeline.timed_out(99));
+  CHECK(pipeline.timed_out(100));
+  for (auto &request : pipeline.pop_timed_out(100)) {
+    request.callback(RequestResult::TIMEOUT, {});
+  }
+  CHECK_EQ(results.size(), 2);
+  CHECK_EQ(pipeline.sent(), 0);
+  CHECK_EQ(pipeline.size(), 1);
+  // the third request starts its own timeout and goes out alone
+  CHECK(!pipeline.timed_out(199));
+  CHECK(pipeline.next_unsent() != nullptr);
+  pipeline.mark_sent();
+  ring->consume(ring->available());
+  pipeline.on_consumed();
+  const std::string answer = "c-ok\r\n";
+  ring->write(reinterpret_cast<const uint8_t *>(answer.data()), answer.size());
+  CHECK_EQ(pipeline.match(*ring), answer.size());
+  // an unsent head times out alone
+  pipeline.pop(200);
+  pipeline.push({'d'}, ResponseMatcher::length(1), 50, record, 200);
+  pipeline.set_max_outstanding(1);
+  CHECK_EQ(pipeline.pop_timed_out(250).size(), 1);
+  CHECK(pipeline.empty());
+}
+
+static void test_tx_chunk_offset_and_wrap() {
+  // the server's broadcast path cuts from an offset past the read position; both paths must stitch the wrap
+  auto ring = ByteRing::create(32);
+  const auto pad = pseudo_random(28, 7);
+  ring->write(pad.data(), pad.size());
+  ring->consume(pad.size());
+  const auto data = pseudo_random(20, 9);
+  ring->write(data.data(), data.size());
+  std::vector<uint8_t> staging(16);
+  std::vector<uint8_t> raw(LZ_MAX_CHUNK_INPUT);
+  for (bool compress : {false, true}) {
+    LzEncoder encoder;
+    LzDecoder decoder;
+    const size_t offset = 2;
+    const TxChunk chunk = next_tx_chunk(*ring, offset, staging.size(), staging.data(),
+                                        compress ? &encoder : nullptr, raw.data());
+    CHECK(chunk.len > 0 && chunk.len <= staging.size());
+    std::vector<uint8_t> out(chunk.data, chunk.data + chunk.len);
+    if (compress) {
+      out.clear();
+      CHECK(decoder.decode_chunk(chunk.data, chunk.len,
+                                 [&out](const uint8_t *d, size_t n) { out.insert(out.end(), d, d + n); }));
+    }
+    CHECK_EQ(out.size(), chunk.consumed);
+    CHECK(std::equal(out.begin(), out.end(), data.begin() + offset));
+    CHECK_EQ(ring->available(), data.size());  // nothing consumed
+  }
+  CHECK_EQ(next_tx_chunk(*ring, data.size(), staging.size(), staging.data(), nullptr, nullptr).len, 0);
+}
+
+static void test_lz_chunk_decodes_to_bounded_size() {
+  // the largest legal chunk: LZ_MAX_CHUNK_INPUT zeros, which the encoder packs into a handful of matches
+  const std::vector<uint8_t> zeros(LZ_MAX_CHUNK_INPUT, 0);
+  uint8_t chunk[64];
+  size_t consumed = 0;
+  LzEncoder encoder;
+  const size_t len = encoder.encode_chunk(zeros.data(), zeros.size(), chunk, sizeof(chunk), &consumed);
+  CHECK_EQ(consumed, LZ_MAX_CHUNK_INPUT);
+  size_t decoded = 0;
+  LzDecoder decoder;
+  CHECK(decoder.decode_chunk(chunk, len, [&decoded](const uint8_t *, size_t n) { decoded += n; }));
+  CHECK_EQ(decoded, LZ_MAX_CHUNK_INPUT);
+  // one more match past the bound is rejected
+  const uint8_t oversized[] = {LZ_CHUNK_LZ, 0x3E, 0, 0, 255, 0, 255, 0, 255, 0, 255, 0, 255};
+  LzDecoder fresh;
+  CHECK(!fresh.decode_chunk(oversized, sizeof(oversized), [](const uint8_t *, size_t) {}));
+}
+
+int main() {
+  test_byte_stream_round_trip();
+  test_frames_round_trip();
+  test_frame_resync_after_corruption();
+  test_rx_overflow_accounting();
+  test_messages_across_chunks();
+  test_messages_after_another_reader();
+  test_response_after_another_reader();
+  test_pipelined_head_timeout();
+  test_tx_chunk_offset_and_wrap();
+  test_lz_chunk_decodes_to_bounded_size();
+  return host_test_result("test_link_pipeline");
+}